@@ -32,9 +32,16 @@ static void EEPROM_defaults()
     settings->dfs = DF1718;
     settings->ac_type = 0;
     settings->chk_crc = 0;
+    settings->fixbits = 0;
+    settings->batch = 8;
+    settings->batchms = 2;
     settings->incl_rssi = 0;
     settings->rx_pin = 255;  // 16;
     settings->tx_pin = 255;  // 17;
+    settings->gnss_pin = 255;   // none
+    settings->negttl = 5;
+    settings->evict = EVICTPRIO;
+    settings->ownalt = NO_OWNALT;
     settings->comparator = 100;
     settings->outbaud = 0;
     settings->debug = 0;
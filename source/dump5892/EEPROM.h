@@ -12,7 +12,7 @@
 #define EEPROM_H
 
 #define EEPROM_MAGIC   0x10905892
-#define EEPROM_VERSION 0x00000003
+#define EEPROM_VERSION 0x00000008
 
 enum
 {
@@ -50,6 +50,14 @@ enum
     DFNOTL
 };
 
+enum
+{
+    EVICTDIST,
+    EVICTPRIO
+};
+
+#define NO_OWNALT 0xFFFF
+
 typedef struct Settings {
 
     float   latitude;   // of this station (can be approximate)
@@ -70,10 +78,13 @@ typedef struct Settings {
     uint8_t  comparator;  // GNS5892 module sensitivity setting
     uint8_t  debug;     // debug verbosity level 0,1,2
     uint8_t  outbaud;   // faster output baud rate
-
-    uint8_t  rsvd1;
-    uint8_t  rsvd2;
-    uint8_t  rsvd3;
+    uint8_t  fixbits;   // max # of bits to correct in ES frames with CRC error
+    uint8_t  batch;     // max # of input sentences processed per loop()
+    uint8_t  batchms;   // max time spent on one batch, ms
+    uint8_t  gnss_pin;  // GPIO pin for Serial1 (GNSS NMEA) input
+    uint8_t  negttl;    // seconds to skip aircraft after a rejected position
+    uint8_t  evict;     // EVICTDIST etc - which aircraft to drop when full
+    uint16_t ownalt;    // own altitude, hundreds of feet, or NO_OWNALT
 
 } __attribute__((packed)) settings_t;
 
@@ -142,6 +142,7 @@ void show_settings()
     Serial.println(time_string(true));
     char types[64];
     char IDs[64];
+    char own[32];
     if (settings->ac_type == 0)
         snprintf(types,64,"Show all ('0') aircraft types");
     else if (settings->ac_type == 254)
@@ -154,6 +155,10 @@ void show_settings()
         snprintf(IDs,64,"Show all ('0') aircraft IDs");
     else
         snprintf(IDs,64,"Only show aircraft ID %06X", settings->follow);
+    if (settings->ownalt == NO_OWNALT)
+        snprintf(own,32,"not set");
+    else
+        snprintf(own,32,"%d feet", 100*settings->ownalt);
 Serial.printf("\n\
 CURRENT SETTINGS:\n\n\
 LOC - reference location, lat/lon: %.5f %.5f\n\
@@ -162,7 +167,7 @@ Output format:\n\
     %s\n\
     %s\n\
     BRG - Show %s\n",
-reflat, reflon, time_string(true),
+cprref->reflat, cprref->reflon, time_string(true),
 (settings->parsed==NOTHING? "NON - do not export detailed data" :
  settings->parsed==RAWFMT?  "RAW - export raw hex format" :
  settings->parsed==RAWFILT? "FIL - export raw, but filtered" :
@@ -179,20 +184,30 @@ Serial.printf("\n\
 GNS5892 data export options:\n\
     GPIO pin for serial RX from radio module: %d\n\
     GPIO pin for serial TX to radio module: %d\n\
+    GPIO pin for NMEA input from GNSS receiver: %d\n\
     Receiver comparator level set to %d\n\
     %s\n\
     %s\n\
+    Correct up to %d bit errors in ES frames\n\
+    Process up to %d sentences or %d ms per batch\n\
 \nData filtering options:\n\
     range %d-%d nm\n\
+    skip an aircraft for %d s after rejecting its position\n\
+    %s\n\
+    OWN - own altitude %s\n\
     %s\n\
     %s\n\
     %s\n\
     %s\n\
 \nDebug verbosity level: %d\n\n",
-settings->rx_pin, settings->tx_pin, settings->comparator,
+settings->rx_pin, settings->tx_pin, settings->gnss_pin, settings->comparator,
 (settings->incl_rssi? "Include RSSI" : "Skip RSSI"),
 (settings->chk_crc? "Compute and check CRC" : "Ignore CRC"),
-settings->minrange, settings->maxrange,
+settings->fixbits, settings->batch, settings->batchms,
+settings->minrange, settings->maxrange, settings->negttl,
+(settings->evict==EVICTDIST? "EVD - when full, drop the farthest aircraft" :
+ settings->evict==EVICTPRIO? "EVP - when full, drop the lowest-priority aircraft" : "?"),
+own,
 (settings->alts==LOWALT?  "only show traffic below 18,000 feet" :
  settings->alts==MEDALT?  "only show traffic between 18,000 and 50,000 feet" :
  settings->alts==HIGHALT? "only show traffic above 50,000 feet (shown as 99999)" :
@@ -211,20 +226,25 @@ types, IDs, settings->debug);
 
 static void table()
 {
-  Serial.printf("\nTRAFFIC TABLE currently:\n\n%d aircraft tracked\n\n", num_tracked);
+  Serial.printf("\nTRAFFIC TABLE currently:\n\n%d aircraft tracked, %d on the ground\n\n",
+      num_tracked, num_ground);
   const char *s = (settings->format==TXTFMT? " " : settings->format==TABFMT? "\t" : ",");
   char *t = time_string(true);    // a bit later than actual position time
-  for (int i=0; i < MAX_TRACKING_OBJECTS; i++) {
-     ufo_t *fop = &container[i];
+  char line[160];
+  ufo_t f;
+  ufo_t *fop = &f;
+  for (int i=0; i < TRAFFIC_SLOTS; i++) {
+     if (traffic_addr(i) == 0)        // empty slot, nothing to show
+        continue;
+     traffic_snapshot(i, fop);
+     if (fop->addr == 0)              // (emptied since)
+        continue;
      // construct a single line of text about each slot in traffic table
      const char *cs = fop->callsign;
      if (cs[0] == '\0' && settings->format == TXTFMT)
         cs = "        ";
      const char *fmt;
-     if (fop->addr == 0) {
-        // snprintf(parsed, PARSE_BUF_SIZE, "[%2d]\r\n", i);
-        parsed[0] = '\0';
-     } else if (timenow > fop->positiontime + 15) {
+     if (timenow > fop->positiontime + 15) {
        if (settings->format==TABFMT)
          fmt = "[%d]\t%s\t%d\t%06X\t%s\t%d\r\n";
        if (settings->format==CSVFMT)
@@ -232,7 +252,7 @@ static void table()
        else // TXTFMT
          fmt = "[%2d] %s %02d %06X %s %02d\r\n";
                //idx time rssi  ID cs actyp
-       snprintf(parsed, PARSE_BUF_SIZE, fmt,
+       snprintf(line, sizeof(line), fmt,
          i, t, fop->rssi, fop->addr, cs, fop->aircraft_type);
      } else  if (settings->dstbrg) {
        if (settings->format==TABFMT)
@@ -242,7 +262,7 @@ static void table()
        else // TXTFMT
          fmt = "[%2d] %s %02d %06X %s %02d %5.1f %03d %s %5d %5d %5d %3d %3d %3d %3d\r\n";
               //idx time rssi ID cs actyp dst brg altitude altdif vs gspd trk aspd hdg
-       snprintf(parsed, PARSE_BUF_SIZE, fmt,
+       snprintf(line, sizeof(line), fmt,
          i, t, fop->rssi, fop->addr, cs, fop->aircraft_type,
          fop->distance, fop->bearing,
          (fop->alt_type? "g" : ""), fop->altitude, fop->alt_diff, fop->vert_rate,
@@ -255,14 +275,14 @@ static void table()
        else // TXTFMT
          fmt = "[%2d] %s %02d %06X %s %02d %9.4f %9.4f %s %5d %5d %5d %3d %3d %3d %3d\r\n";
                //idx time rssi ID cs actyp lat lon altitud altdif vs gspd trk aspd hdg
-       snprintf(parsed, PARSE_BUF_SIZE, fmt,
+       snprintf(line, sizeof(line), fmt,
          i, t, fop->rssi, fop->addr, cs, fop->aircraft_type,
          fop->latitude, fop->longitude,
          (fop->alt_type? "g" : ""), fop->altitude, fop->alt_diff, fop->vert_rate,
          fop->groundspeed, fop->track, fop->airspeed, fop->heading);
     }
-    Serial.print(parsed);
-    delay(10);
+    Serial.print(line);
+    delay(10);       // only after a line, so that the output can drain
   }
   Serial.println("");
 }
@@ -272,6 +292,19 @@ static void stats()
     Serial.println("\nSTATISTICS (since last reboot):\n\n");
     Serial.printf("Input  discards (overflow): %6d\n", in_discards);
     Serial.printf("Output discards (overflow): %6d\n", out_discards);
+#if defined(THREADED)
+    Serial.printf("Output queue full (dropped): %5d   max depth: %d of %d\n",
+            outq_full, outq_maxdepth, OUTQ_SIZE);
+#endif
+    Serial.printf("Partial input sentences:    %6d\n", in_partial);
+    Serial.printf("Overlong input sentences:   %6d\n", in_overlong);
+    Serial.printf("Malformed input sentences:  %6d\n", in_malformed);
+    if (batch_count) {
+        Serial.printf("\nBatches processed: %d, avg %.1f sentences, %d us\n",
+            batch_count, (float) batch_sentences / batch_count, batch_us / batch_count);
+        Serial.printf("    max: %d sentences, %d us, time limit reached %d times\n",
+            batch_max_sentences, batch_max_us, batch_timeouts);
+    }
     int i;
     if (settings->incl_rssi) {
         Serial.println("\nMessages by RSSI:");
@@ -283,6 +316,10 @@ static void stats()
     if (settings->chk_crc) {
         Serial.printf("\nMessages with CRC error: %d\n", msg_by_crc_cat[1]);
         Serial.printf("Messages with CRC OK: %d\n", msg_by_crc_cat[0]);
+        if (settings->fixbits) {
+            Serial.printf("Messages corrected (1 bit):  %d\n", msg_by_crc_cat[2]);
+            Serial.printf("Messages corrected (2 bits): %d\n", msg_by_crc_cat[3]);
+        }
     }
     Serial.println("\nMessages by hour:");
     for (i=0; i<24; i++) {
@@ -298,6 +335,48 @@ static void stats()
     Serial.printf("Position messages with adjacent CPR NL:    %6d\n", msg_by_cpr_effort[1]);
     Serial.printf("Position messages needing CPR NL search:   %6d\n", msg_by_cpr_effort[2]);
     Serial.printf("Position messages with CPR error:          %6d\n", msg_by_cpr_effort[3]);
+    Serial.printf("\nPositions decoded relative to our location:   %6d\n", msg_by_cpr_method[0]);
+    Serial.printf("Positions decoded relative to own last fix:   %6d\n", msg_by_cpr_method[1]);
+    Serial.printf("Positions decoded from odd/even pair:         %6d\n", msg_by_cpr_method[2]);
+    Serial.printf("Odd/even pairs that failed to decode:         %6d\n", msg_by_cpr_method[3]);
+    Serial.printf("\nOwn-ship positions from GNSS:                 %6d\n", gnss_fixes);
+    Serial.printf("GNSS sentences rejected:                      %6d\n", gnss_rejects);
+    Serial.printf("CPR reference rebuilds:                       %6d\n", cpr_rebuilds);
+    float minutes = millis() / 60000.0 + 0.001;
+    Serial.printf("\nAirborne position messages:   %6d  (%.1f per minute)\n",
+        msg_airborne, msg_airborne / minutes);
+    Serial.printf("Surface position messages:    %6d  (%.1f per minute)\n",
+        msg_surface, msg_surface / minutes);
+    Serial.printf("  - rejected early, too far:  %6d\n", pos_prefiltered);
+    Serial.printf("  - skipped, recently rejected: %4d  (%d s)\n", negcache_hits, settings->negttl);
+    Serial.printf("  - not recently rejected:    %6d  (%d given another chance)\n",
+        negcache_misses, negcache_expired);
+    Serial.printf("Ground traffic tracked now:   %6d  (of %d)\n", num_ground, MAX_GROUND_OBJECTS);
+    Serial.printf("Ground traffic expired:       %6d\n", ground_expired);
+    Serial.printf("Ground traffic ignored, full: %6d\n", ground_full);
+    Serial.printf("Traffic landed / took off:    %6d / %d\n", ground_moves[0], ground_moves[1]);
+    int evicted = 0, rejected = 0;
+    for (int r=0; r < EVICT_REASONS; r++) {
+        evicted += evicted_by_reason[r];
+        rejected += rejected_by_reason[r];
+    }
+    if (evicted + rejected > 0) {
+        static const char *reason_label[EVICT_REASONS] =
+            { "quiet", "distance", "altitude", "message rate", "age", "aircraft type" };
+        Serial.printf("\nTable full, traffic dropped / new traffic ignored: %d / %d\n",
+            evicted, rejected);
+        for (int r=0; r < EVICT_REASONS; r++) {
+            if (evicted_by_reason[r] + rejected_by_reason[r] > 0)
+                Serial.printf("  - by %-14s %6d / %d\n", reason_label[r],
+                    evicted_by_reason[r], rejected_by_reason[r]);
+        }
+    }
+    if (commb_addr[0] + commb_addr[1] > 0) {
+        Serial.printf("\nComm-B replies from traffic in the table: %6d  (ID not known: %d)\n",
+            commb_addr[0], commb_addr[1]);
+        Serial.printf("  - inferred BDS 4,0 / 5,0 / 6,0: %d / %d / %d  (unsure: %d)\n",
+            msg_by_bds[0], msg_by_bds[1], msg_by_bds[2], msg_by_bds[3]);
+    }
     Serial.println("\nMessages by DF:");
     for (i=0; i<23; i++) {
         if (msg_by_DF[i] > 0)
@@ -334,7 +413,7 @@ static void stats()
             Serial.printf("    [%2d] %6d  %s\n", i, new_by_aircraft_type[i], ac_type_label[i]);
     }
     delay(100);
-    Serial.println("\nTicks by number tracked:");
+    Serial.println("\nSeconds by number tracked:");
     for (i=0; i<MAX_TRACKING_OBJECTS+1; i++) {
         if (ticks_by_numtracked[i] > 0)
             Serial.printf("    [%2d] %6d\n", i, ticks_by_numtracked[i]);
@@ -352,6 +431,37 @@ static void stats()
 #endif
 }
 
+#if defined(PROFILING)
+// show the cycle counts of each stage since the last PRF, and start over
+static void profile()
+{
+    static const char *names[PRF_STAGES] = {
+        "input_loop", "parse", "decodeCPR", "traffic_loop", "output_loop", "cmd_loop"
+    };
+    Serial.println("\nPROFILE (CPU cycles per call, since last PRF):\n");
+    for (int i=0; i<PRF_STAGES; i++) {
+        prf_stage_t *p = &prf_stages[i];
+        if (p->count == 0) {
+            Serial.printf("%-18s     no calls\n", names[i]);
+            continue;
+        }
+        Serial.printf("%-18s %9d calls, mean %9d, max %10u\n",
+            names[i], p->count, (uint32_t) (p->total / p->count), p->max);
+        for (int k=0; k<32; k++)
+            if (p->hist[k] > 0)
+                Serial.printf("    [%10u+] %9d\n", (1U << k), p->hist[k]);
+        delay(10);
+    }
+    memset(prf_stages, 0, sizeof(prf_stages));
+}
+#endif
+
+#if defined(PROFILING)
+#define PRF_HELP "PRF - show CPU cycles taken by each processing stage, and reset\n"
+#else
+#define PRF_HELP ""
+#endif
+
 static void help()
 {
 Serial.println("\
@@ -370,7 +480,7 @@ HLP - list all commands\n\
 COD - list aircraft and message type codes\n\
 TBL - list table of aircraft recently seen\n\
 STA - show stats (# of frames received, # and % in aircraft types, etc)\n\
-SET - show current settings\n\
+" PRF_HELP "SET - show current settings\n\
 SAV - save settings to flash memory\n");
 
 Serial.println("\
@@ -395,7 +505,9 @@ Settings that toggle current value:\n\
 BRG - show lat/lon or distance/bearing in decoded output\n\
 RSS - include RSSI in data (switches 5892 to mode 3+)\n\
 BAU - output at 230,400 baud rather than 115,200\n\
-CRC - compute and check CRC\n");
+CRC - compute and check CRC\n\
+FIX,n - correct up to n (0-2) bit errors in ES frames (needs CRC)\n\
+BAT,n,ms - process up to n sentences (1-255) or ms milliseconds per batch\n");
 
 Serial.println("\
 Aircraft filtering options:\n\
@@ -409,7 +521,11 @@ TYP,tt - only show aircraft type tt (1-15)\n\
        - 'TYP,#' means show types medium - heavy (10-13)\n\
        - 'TYP,~' means show types *other than* medium - heavy\n\
        - 'TYP' alone means show all aircraft types\n\
-TRK,xxxxxx - only show ICAO ID xxxxxx ('TRK,n by index) ('TRK' to cancel)\n");
+TRK,xxxxxx - only show ICAO ID xxxxxx ('TRK,n by index) ('TRK' to cancel)\n\
+NEG,ss - skip an aircraft for ss seconds (0-60) after it is filtered out ('NEG' for 5)\n\
+EVD - when the traffic table is full, drop the farthest aircraft\n\
+EVP - when full, drop by priority: distance, altitude, rate, age, type\n\
+OWN,ffff - own altitude ffff feet, for EVP ('OWN' to ignore altitude)\n");
 
 Serial.println("\
 Data filtering options:\n\
@@ -425,7 +541,9 @@ Receiver setup:\n\
 RIO,nn - GPIO pin for serial RX from radio module <<< REQUIRED\n\
 TIO,nn - GPIO pin for serial TX to radio module   <<< REQUIRED\n\
 CMP,nn - set the receiver comparator level to nn (10-200, default 100)\n\
-LOC,lat,lon - location (decimal degrees, e.g., 42.36,-97.32) <<< REQUIRED\n");
+LOC,lat,lon - location (decimal degrees, e.g., 42.36,-97.32) <<< REQUIRED\n\
+GPS,nn - GPIO pin for NMEA input from a GNSS receiver ('GPS' for none)\n\
+       - updates the location as it moves, as do $GPGGA/$GPRMC lines typed here\n");
 }
 
 static void codes()
@@ -458,6 +576,7 @@ Message type codes:\n\
    V velocity (DF17-18)\n\
    L all-call reply (DF11)\n\
    B Comm-B altitude (DF20)\n\
+   D Comm-B identity (DF21)\n\
    C ACAS long (DF16)\n\
    S ACAS short (DF 0)\n\
    A mode S altitude (DF 4)\n");
@@ -478,6 +597,18 @@ static bool setvalue(const char *label, const char *cmd, uint8_t *psetting, uint
     return false;
 }
 
+// the commands that change what positions parse() rejects
+static bool changes_filter(const char *cmd)
+{
+    static const char *filters[] =
+        { "MIN", "MAX", "ALL", "LOC", "TYP", "LOW", "MED", "HIG", "TRK", "NEG" };
+    for (unsigned i=0; i < sizeof(filters)/sizeof(filters[0]); i++) {
+        if (strcmp(filters[i], cmd) == 0)
+            return true;
+    }
+    return false;
+}
+
 // interpret the string in the command buffer and execute
 void interpret_cmd(char *sentence, int len)
 {
@@ -501,6 +632,11 @@ Serial.println("(empty command)");
   char *cmd = &sentence[0];
   cmd[3] = '\0';
   strupr(cmd);
+
+  // the aircraft rejected so far may not be now - these commands are not
+  //   read-only, so the receive task is held meanwhile, see cmd_loop()
+  if (changes_filter(cmd))
+      negcache_clear();
   char *param;
   if (len > 4)
       param = &sentence[4];
@@ -551,6 +687,11 @@ Serial.println("(empty command)");
   if (setvalue("MED", cmd, &settings->alts, MEDALT, "only show traffic between 18,000 and 50,000 feet"))  return;
   if (setvalue("HIG", cmd, &settings->alts, HIGHALT, "only show traffic above 50,000 feet"))  return;
 
+  if (setvalue("EVD", cmd, &settings->evict, EVICTDIST, "when full, drop the farthest aircraft"))
+      {traffic_rerank();  return;}
+  if (setvalue("EVP", cmd, &settings->evict, EVICTPRIO, "when full, drop the lowest-priority aircraft"))
+      {traffic_rerank();  return;}
+
   if (strcmp("ALL",cmd)==0) {
       settings->minrange = 0;
       minrange10 = 0;
@@ -560,6 +701,7 @@ Serial.println("(empty command)");
       settings->alts = ALLALTS;
       settings->ac_type = 0;
       settings->follow = 0;
+      traffic_rerank();
       Serial.println("> show all traffic - distances, altitudes, types, ID");
       return;
   }
@@ -589,11 +731,16 @@ Serial.println("(empty command)");
    || strcmp("TRK",cmd)==0
    || strcmp("MIN",cmd)==0
    || strcmp("MAX",cmd)==0
+   || strcmp("NEG",cmd)==0
+   || strcmp("OWN",cmd)==0
    || strcmp("DBG",cmd)==0
+   || strcmp("FIX",cmd)==0
+   || strcmp("BAT",cmd)==0
    || strcmp("RIO",cmd)==0
    || strcmp("TIO",cmd)==0
    || strcmp("CMP",cmd)==0
    || strcmp("LOC",cmd)==0
+   || strcmp("GPS",cmd)==0
    || strcmp("TIM",cmd)==0
    || strcmp("DAT",cmd)==0) {
 
@@ -603,6 +750,7 @@ Serial.println("(empty command)");
               Serial.println("> show all aircraft types");
           } else if (strcmp("TRK",cmd)==0) {
               settings->follow = 0;
+              traffic_rerank();
               Serial.println("> show all aircraft IDs");
           } else if (strcmp("MIN",cmd)==0) {
               settings->minrange = 0;
@@ -613,9 +761,26 @@ Serial.println("(empty command)");
               maxcprdiff = (1<<16);
               maxrange10 = 1800;
               Serial.println("> maximum distance 180nm");
+          } else if (strcmp("NEG",cmd)==0) {
+              settings->negttl = 5;
+              Serial.println("> skip filtered-out aircraft for 5 s");
+          } else if (strcmp("OWN",cmd)==0) {
+              settings->ownalt = NO_OWNALT;
+              traffic_rerank();
+              Serial.println("> own altitude not set");
           } else if (strcmp("DBG",cmd)==0) {
               settings->debug = 1;
               Serial.println("> debug level 1");
+          } else if (strcmp("BAT",cmd)==0) {
+              settings->batch = 1;
+              Serial.println("> one sentence per loop (no batching)");
+          } else if (strcmp("FIX",cmd)==0) {
+              settings->fixbits = 0;
+              crc_fix_setup(0);
+              Serial.println("> no CRC error correction");
+          } else if (strcmp("GPS",cmd)==0) {
+              settings->gnss_pin = 255;
+              Serial.println("> no GNSS input - now 'SAV' and 'RBT'");
           } else if (strcmp("TIM",cmd)==0) {
               Serial.printf("> Our clock currently: %02d:%02d\n",
                  ourclock.hour, ourclock.minute);
@@ -654,6 +819,30 @@ Serial.println("(empty command)");
           return;
       }
 
+      if (strcmp("NEG",cmd)==0) {
+          if (param1 >= 0 && param1 <= 60) {
+              settings->negttl = param1;
+              if (param1)
+                  Serial.printf("> skip filtered-out aircraft for %d s\n", param1);
+              else
+                  Serial.println("> do not skip filtered-out aircraft");
+          } else {
+              Serial.println("> must be between 0 and 60 seconds");
+          }
+          return;
+      }
+
+      if (strcmp("OWN",cmd)==0) {
+          if (param1 >= 0 && param1 <= 60000) {
+              settings->ownalt = (param1 + 50) / 100;
+              traffic_rerank();
+              Serial.printf("> own altitude %d feet\n", 100*settings->ownalt);
+          } else {
+              Serial.println("> own altitude must be between 0 and 60,000 feet");
+          }
+          return;
+      }
+
       if (strcmp("TYP",cmd)==0) {
           if (strcmp(param,"#")==0) {
               settings->ac_type = 254;
@@ -676,14 +865,15 @@ Serial.println("(empty command)");
       if (strcmp("TRK",cmd)==0) {
           uint32_t addr = strtol(param,NULL,16);
           if (addr < 0x100) {
-              if (param1 >= 0 && param1 < MAX_TRACKING_OBJECTS) {
-                  addr = container[param1].addr;
+              if (param1 >= 0 && param1 < TRAFFIC_SLOTS) {
+                  addr = traffic_addr(param1);
               } else {
                   Serial.println("> use TRK,ICAO or TRK,index");
                   return;
               }
           }
           settings->follow = addr;
+          traffic_rerank();
           Serial.printf("> show only ICAO ID %06X ('TRK' to cancel)\n", addr);
           return;
       }
@@ -719,10 +909,20 @@ Serial.println("(empty command)");
           return;
       }
 
+      if (strcmp("GPS",cmd)==0) {
+          if (param1 > 0 && param1 < 40) {
+              settings->gnss_pin = param1;
+              Serial.printf("> GNSS RX pin set to %d - now 'SAV' and 'RBT'\n", param1);
+          } else {
+              Serial.println("> invalid GNSS RX pin");
+          }
+          return;
+      }
+
       if (strcmp("LOC",cmd)==0) {
           sscanf(param, "%f,%f", &settings->latitude, &settings->longitude);
           CPRRelative_precomp();
-          Serial.printf("> Our location set to: %f, %f\n", reflat, reflon);
+          Serial.printf("> Our location set to: %f, %f\n", cprref->reflat, cprref->reflon);
           return;
       }
 
@@ -740,6 +940,32 @@ Serial.println("(empty command)");
           return;
       }
 
+      if (strcmp("BAT",cmd)==0) {
+          int n = 0;
+          int ms = settings->batchms;
+          sscanf(param, "%d,%d", &n, &ms);
+          if (n >= 1 && n <= 255 && ms >= 1 && ms <= 100) {
+              settings->batch = n;
+              settings->batchms = ms;
+              Serial.printf("> up to %d sentences or %d ms per batch\n", n, ms);
+          } else {
+              Serial.println("> batch must be 1-255 sentences, 1-100 ms");
+          }
+          return;
+      }
+
+      if (strcmp("FIX",cmd)==0) {
+          if (param1 >= 0 && param1 <= 2) {
+              settings->fixbits = param1;
+              crc_fix_setup(param1);
+              Serial.printf("> correct up to %d bit errors%s\n", param1,
+                  (settings->chk_crc? "" : " (turn on CRC for this to work)"));
+          } else {
+              Serial.println("> bits to correct must be between 0 and 2");
+          }
+          return;
+      }
+
       if (strcmp("DBG",cmd)==0) {
           if (param1 >= 0 && param1 <= 2) {
               settings->debug = param1;
@@ -762,6 +988,11 @@ Serial.println("(empty command)");
   else if (strcmp("STA",cmd)==0)
       stats();
 
+#if defined(PROFILING)
+  else if (strcmp("PRF",cmd)==0)
+      profile();
+#endif
+
   else if (strcmp("SET",cmd)==0)
       show_settings();
 
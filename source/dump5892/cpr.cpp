@@ -84,7 +84,7 @@ static int cprNLFunction_original(float lat) {
 }
 */
 
-static float NLtable[61] = {
+static const double NLtable[61] = {
  90.0,        // 0
  90.0,        // 1
  87.00000000, // 2
@@ -148,39 +148,82 @@ static float NLtable[61] = {
            0  // 60
 };
 
-// this function is recursive - bi-section search
-static int cprNLFunction_(float lat, int start, int end) {
+// the same latitudes as binary angles, see CPRRelative_setup()
+// - with a [61] for the zone beyond NL=59 that does not exist
+static uint32_t NLbam[62];
+
+//
+//=========================================================================
+//
+// Positions are worked out in integers only:  as binary angles (2^32 per
+// revolution, so that an int32_t wraps around at +-180 degrees by itself),
+// and within the CPR zones in units of 2^-17 zone, the resolution of the
+// transmitted cprlat & cprlon.  A position in zone units is (j << 17) + cpr,
+// where j is the zone index and cpr is the 17-bit fraction.
+//
+
+#define DEG2BAM  11930464.711111111      // 2^32/360
+#define BAM2DEG  8.381903171539307e-8    // 360/2^32
+
+// 2^31/nz for nz zones in 360 degrees, to convert zone units to binary angles
+static uint32_t zoneK[61];
+
+static inline int32_t bam2zone(int32_t bam, int nz)
+{
+    return (int32_t) (((int64_t) bam * nz + (1<<14)) >> 15);
+}
+
+static inline int32_t zone2bam(int32_t z, int nz)
+{
+    return (int32_t) (((int64_t) z * zoneK[nz]) >> 16);
+}
+
+static inline uint32_t absbam(int32_t bam)
+{
+    return (bam < 0 ? -(uint32_t) bam : (uint32_t) bam);
+}
+
+// the position with the given 17-bit CPR fraction in the zone nearest to a
+// reference position - which is thus never more than 1/2 zone away
+static inline int32_t cpr_nearest(int32_t refz, uint32_t cpr)
+{
+    return ((refz - (int32_t) cpr + (1<<16)) >> 17) * (1<<17) + (int32_t) cpr;
+}
+
+// this function is recursive - bi-section search - now only used in setup
+static int cprNLsearch(uint32_t abslat, int start, int end) {
     // we already know that NL >= start and NL <= end
     if (end <= start+1) {
-        if (lat < NLtable[end])
+        if (abslat < NLbam[end])
             return end;
         return start;
     }
     int mid = ((start+end) >> 1);
-    if (lat < NLtable[mid])
-        return cprNLFunction_(lat, mid, end);
-    return cprNLFunction_(lat, start, mid-1);
+    if (abslat < NLbam[mid])
+        return cprNLsearch(abslat, mid, end);
+    return cprNLsearch(abslat, start, mid-1);
 }
 
-static int cprNLFunction(float lat) {
-    if (lat < 0) lat = -lat; // Table is symmetric about the equator
-    return cprNLFunction_(lat, 1, 59);
-}
+// The NL at the start of each 1/256 of 0..90 degrees (2^22 binary angle).
+// The NL zones are all wider than that (the narrowest, NL=2, is 0.46 deg),
+// so within one of these slices NL can only go down by one.
+static uint8_t NLslice[257];
 
-// store these numbers to avoid having to repeatdely do the divisions 360/NL & NL/360
-static float dLonTable[60];
-static float dLonInvTable[60];
-// - if we are *really* short on memory space, can wait for GNSS fix first,
-//   and then only set the tables up for latitudes near us
+static inline int cprNLFunction_(uint32_t abslat) {
+    int NL = NLslice[abslat >> 22];
+    if (NL > 1 && abslat >= NLbam[NL])
+        NL--;
+    return NL;
+}
 
-// this version uses a pre-computed NL
-static float cprDlonFunction(int fflag, int NL) {
-    if (NL > 1 && fflag)  NL--;
-    return dLonTable[NL];
+int cprNLFunction(int32_t lat) {
+    return cprNLFunction_(absbam(lat));    // Table is symmetric about the equator
 }
-static float cprDlonInvFunction(int fflag, int NL) {
+
+// the number of longitude zones, from NL and the odd/even flag
+static inline int cprNi(int fflag, int NL) {
     if (NL > 1 && fflag)  NL--;
-    return dLonInvTable[NL];
+    return NL;
 }
 
 //
@@ -189,234 +232,568 @@ static float cprDlonInvFunction(int fflag, int NL) {
 // This algorithm comes from:
 // 1090-WP29-07-Draft_CPR101 (which also defines decodeCPR() )
 //
-// Despite what the earlier comment here said, we should *not* be using trunc().
-// See Figure 5-5 / 5-6 and note that floor is applied to (0.5 + fRP - fEP), not
-// directly to (fRP - fEP). Eq 38 is correct.
+// The zone index is chosen as the one that puts the target nearest to us,
+// i.e., floor(0.5 + fRP - fEP) as in Eq 38, so the result is never more than
+// 1/2 zone away, in latitude or in longitude, and there is no need to check.
 //
-int decodeCPRrelative()
+// Returns the effort it took (see below), or -1 if no position - without
+// the statistics, and without touching mm and fo, for decodeCPRbatch() too.
+static inline int cpr_relative(const cprref_t *ref, int f, uint32_t cprlat, uint32_t cprlon,
+                               int32_t *lat, int32_t *lon)
 {
-    // convert incoming cprlxx values to the "fractions" (how far into current zone)
-    float fractional_lat = mm.cprlat * 7.629394531e-6;  // = 1/131072 = 2^-17
-    float fractional_lon = mm.cprlon * 7.629394531e-6;
-
-    float j, m, rlat, rlon;   // will receive decoded position of target
-
-    // Compute the Latitude Index "j", using the odd/even fflag of the incoming message
-    j = flrlat[mm.fflag] + floor(0.5 + modlat[mm.fflag] - fractional_lat);
-    // latitude is zone border + the fractional part
-    rlat = dLat[mm.fflag] * (j + fractional_lat);
-    if (rlat >= 270) rlat -= 360;
-
-    // Check to see that answer is reasonable - i.e. no more than 1/2 zone away
-    float degsdiff = fabs(rlat - reflat);
-    if (degsdiff > dLatHalf) {
-      if (degsdiff > 0.5 * dLat[mm.fflag]) {   // more precise test
-        ++msg_by_cpr_effort[3];
-if(settings->debug)
-Serial.printf("cpr fail: lat %.5f cmp w reflat = %.5f  - %.3f of dLat\n",
-rlon, reflon, fabs(rlat-reflat)/dLat[mm.fflag]);
-        return (-1);                           // Time to give up - Latitude error
-      }
-    }
+    // latitude, from the zone index "j" nearest to ours
+    int32_t rlat = zone2bam(cpr_nearest(ref->reflatz[f], cprlat), 60-f);
+    *lat = rlat;
+    uint32_t absrlat = absbam(rlat);
+    if (absrlat > NLbam[0])                 // beyond the pole, we must be near it
+        return (-1);
 
     // 'NL' is the number of logitude zones for the target's latitude.
-    // NL[] was pre-computed based on reflat (our location), not rlat (target's).
+    // ref->NL[] was pre-computed based on reflat (our location), not rlat (target's).
     // Check whether the pre-computed NL is correct - likely, if target is close.
-    //   - correct if: (fabs(rlat) < NLtable[NL] && fabs(rlat) >= NLtable[NL+1])
-    float dLon2, scaled, flrlon2, modlon2;
-    float absrlat = fabs(rlat);         // the coding of rlon depends on rlat!
-    bool gt0 = (absrlat >= NLtable[NL[mm.fflag]]);
-    bool lt1 = (absrlat < NLtable[NL[mm.fflag]+1]);
+    //   - correct if: (absrlat < NLbam[NL] && absrlat >= NLbam[NL+1])
+    int32_t lonz;
+    int ni;
+    bool gt0 = (absrlat >= NLbam[ref->NL[f]]);
+    bool lt1 = (absrlat < NLbam[ref->NL[f]+1]);
     int effort = 0;
     if (gt0 || lt1) {
-        // NL is incorrect for the target, need to recompute dLon etc.
+        // NL is incorrect for the target, need another longitude zone size.
         // First check whether the correct NL is the current one +-1,
         // which is likely if the target is close to the ref location.
         // For these adjacent NLs we've also pre-computed things.
-        if (lt1 && absrlat >= NLtable[NL[mm.fflag]+2]) {
-            //NL2 = NL[mm.fflag] + 1;
+        if (lt1 && absrlat >= NLbam[ref->NL[f]+2]) {
             effort = 1;
-            dLon2 = dLonPlus[mm.fflag];
-            flrlon2 = flrlonPlus[mm.fflag];
-            modlon2 = modlonPlus[mm.fflag];
-        } else if (gt0 && absrlat < NLtable[NL[mm.fflag]-1]) {
-            //NL2 = NL[mm.fflag] - 1;
+            ni = cprNi(f, ref->NL[f]+1);
+            lonz = ref->reflonzPlus[f];
+        } else if (gt0 && absrlat < NLbam[ref->NL[f]-1]) {
             effort = 1;
-            dLon2 = dLonMinus[mm.fflag];
-            flrlon2 = flrlonMinus[mm.fflag];
-            modlon2 = modlonMinus[mm.fflag];
+            ni = cprNi(f, ref->NL[f]-1);
+            lonz = ref->reflonzMinus[f];
         } else {
             // Shift into non-adjacent zone.  This can be < 100 miles away at lat>45.
-            // No choice but to do the full NL search and recompute.
-            int NL2 = cprNLFunction_(absrlat, 1, 59);     // = cprNLFunction(rlat)
+            // Look up the NL and recompute.
+            int NL2 = cprNLFunction_(absrlat);
             effort = 2;
-            dLon2 = cprDlonFunction(mm.fflag, NL2);
+            ni = cprNi(f, NL2);
+            lonz = bam2zone(ref->reflonbam, ni);
 if(settings->debug>1)
-Serial.printf("non-adjacent! NL=%d  NL2=%d   dLon2=%.3f\n", NL[mm.fflag], NL2, dLon2);
-            scaled = reflon * cprDlonInvFunction(mm.fflag, NL2);
-            flrlon2 = floor(scaled);
-            modlon2 = scaled - flrlon2;
+Serial.printf("non-adjacent! NL=%d  NL2=%d\n", ref->NL[f], NL2);
         }
     } else {     // pre-computed NL is OK
-            dLon2 = dLon[mm.fflag];
-            flrlon2 = flrlon[mm.fflag];
-            modlon2 = modlon[mm.fflag];
+        ni = cprNi(f, ref->NL[f]);
+        lonz = ref->reflonz[f];
     }
 
-    // Compute the Longitude Index "m"
-    m = flrlon2 + floor(0.5 + modlon2 - fractional_lon);
-    // longitude is zone border + the fractional part (whew!)
-    rlon = dLon2 * (m + fractional_lon);
-    if (rlon > 180) rlon -= 360;
+    // longitude, from the zone index "m" nearest to ours
+    *lon = zone2bam(cpr_nearest(lonz, cprlon), ni);
+    return (effort);
+}
 
-    // Check to see that answer is reasonable - i.e. no more than 1/2 zone away
-    degsdiff = fabs(rlon - reflon);
-    if (degsdiff > dLonHalf) {
-      if (degsdiff > 0.5 * dLon2) {    // more precise test
+int decodeCPRrelative(const cprref_t *ref)
+{
+    int32_t rlat, rlon;
+    int effort = cpr_relative(ref, mm.fflag, mm.cprlat, mm.cprlon, &rlat, &rlon);
+    if (effort < 0) {
         ++msg_by_cpr_effort[3];
 if(settings->debug)
-Serial.printf("cpr fail: lon %.5f cmp w reflon = %.5f  - %.3f of dLon\n",
-rlon, reflon, fabs(rlon-reflon)/dLon2);
-        return (-1);                   // Time to give up - Longitude error
-      }
+Serial.printf("cpr fail: lat %.5f cmp w reflat = %.5f\n", rlat * BAM2DEG, ref->reflat);
+        return (-1);
     }
-
     ++msg_by_cpr_effort[effort];
-    fo.latitude  = rlat;
-    fo.longitude = rlon;
+    mm.latbam = rlat;
+    mm.lonbam = rlon;
+    fo.latitude  = rlat * (float) BAM2DEG;
+    fo.longitude = rlon * (float) BAM2DEG;
     return (effort);
 }
 
+//
+//=========================================================================
+//
+// The same for a batch of frames, e.g. in replays of captured traffic, in
+// arrays: the 17-bit cprlat & cprlon and the odd/even flag of each frame in,
+// the position (as binary angles) and the effort (or -1) of each out.
+// Frames from our NL zone or an adjacent one - nearly all - are done in a
+// loop without branches, that the compiler can vectorize, with the zone
+// chosen by comparisons.  The others are then done one at a time.
+// Returns the number of positions decoded.
+//
+
+// a if the mask m is all 1s, b if it is all 0s
+static inline uint32_t cpr_select(uint32_t m, uint32_t a, uint32_t b)
+{
+    return b ^ ((a ^ b) & m);
+}
+
+// zone2bam() with k = zoneK[nz], in 32-bit arithmetic, which vectorizes:
+// z * k >> 16, as (zh * 2^16 + zl) * k >> 16, and the same again for zl * k
+static inline uint32_t zone2bam32(int32_t z, uint32_t k)
+{
+    uint32_t zh = (uint32_t) (z >> 16);
+    uint32_t zl = (uint32_t) z & 0xFFFF;
+    return zh * k + zl * (k >> 16) + ((zl * (k & 0xFFFF)) >> 16);
+}
 
-void CPRRelative_precomp()
+// On the host the loop is built at -O3, whatever the Makefile says, and for
+// AVX2 as well as plain x86-64 (the one for the CPU is chosen at run time):
+// at -O2 GCC only vectorizes what is very cheap to, which this is not, and
+// before SSE4.1 there is no 32-bit vector multiply.
+#if !defined(ARDUINO) && defined(__GNUC__) && !defined(__clang__)
+#if defined(__x86_64__)
+__attribute__((optimize("O3"), target_clones("avx2", "default")))
+#else
+__attribute__((optimize("O3")))
+#endif
+#endif
+int decodeCPRbatch(const cprref_t *ref, int n, const uint32_t *__restrict cprlat,
+                   const uint32_t *__restrict cprlon, const uint8_t *__restrict fflag,
+                   int32_t *__restrict lat, int32_t *__restrict lon, int8_t *__restrict status)
 {
-    // do this every minute or several, using own-ship GNSS position for reflat/reflon
-    // - but in the dump5892 "app" our position is static
+    // the edges of our NL zone and the adjacent ones
+    int NL = ref->NL[0];                   // (the same for odd and even)
+    uint32_t edge_1 = NLbam[NL-1];
+    uint32_t edge0  = NLbam[NL];
+    uint32_t edge1  = NLbam[NL+1];
+    uint32_t edge2  = NLbam[NL+2];
+    uint32_t pole   = NLbam[0];
+
+    // the longitude zones in ours [0], the one with NL+1 [1] and NL-1 [2],
+    // even and odd - in scalars, so that they can be chosen between without
+    // indexing into an array
+    int32_t  z00 = ref->reflonz[0],      z10 = ref->reflonz[1];
+    int32_t  z01 = ref->reflonzPlus[0],  z11 = ref->reflonzPlus[1];
+    int32_t  z02 = ref->reflonzMinus[0], z12 = ref->reflonzMinus[1];
+    int NLm = (NL > 1 ? NL-1 : 1);
+    uint32_t k00 = zoneK[cprNi(0, NL)],   k10 = zoneK[cprNi(1, NL)];
+    uint32_t k01 = zoneK[cprNi(0, NL+1)], k11 = zoneK[cprNi(1, NL+1)];
+    uint32_t k02 = zoneK[cprNi(0, NLm)],  k12 = zoneK[cprNi(1, NLm)];
+    int32_t rlz0 = ref->reflatz[0], rlz1 = ref->reflatz[1];
+    uint32_t klat0 = zoneK[60], klat1 = zoneK[59];
 
-    // pre-compute all that is possible just based on reference lat/lon:
+    for (int i=0; i < n; i++) {
+        uint32_t f = -(uint32_t) (fflag[i] & 1);      // masks, all 1s or 0s
+        int32_t rlz = (int32_t) cpr_select(f, rlz1, rlz0);
+        uint32_t klat = cpr_select(f, klat1, klat0);
+        int32_t rlat = (int32_t) zone2bam32(cpr_nearest(rlz, cprlat[i]), klat);
+        uint32_t a = absbam(rlat);
+        uint32_t own   = -(uint32_t) ((a < edge0) & (a >= edge1));
+        uint32_t plus  = -(uint32_t) ((a < edge1) & (a >= edge2));
+        uint32_t minus = -(uint32_t) ((a >= edge0) & (a < edge_1));
+        uint32_t fail  = -(uint32_t) (a > pole);
+        int32_t lonz = (int32_t) cpr_select(own, cpr_select(f, z10, z00),
+                                 cpr_select(plus, cpr_select(f, z11, z01),
+                                                  cpr_select(f, z12, z02)));
+        uint32_t k = cpr_select(own, cpr_select(f, k10, k00),
+                    cpr_select(plus, cpr_select(f, k11, k01),
+                                     cpr_select(f, k12, k02)));
+        lat[i] = rlat;
+        lon[i] = (int32_t) zone2bam32(cpr_nearest(lonz, cprlon[i]), k);
+        // 0 in our zone, 1 in an adjacent one, else 2 to be done later, or -1
+        uint32_t st = (~own & 1) + (~(own | plus | minus) & 1);
+        status[i] = (int8_t) (st | fail);
+    }
+
+    int decoded = 0;
+    for (int i=0; i < n; i++) {
+        if (status[i] == 2)
+            status[i] = cpr_relative(ref, fflag[i] & 1, cprlat[i], cprlon[i], &lat[i], &lon[i]);
+        decoded += (status[i] >= 0);
+    }
+    return decoded;
+}
+
+//
+//=========================================================================
+//
+// Decoding that does not depend on our own location (after dump1090).
+// Once both an even and an odd frame have arrived from an aircraft not too
+// far apart in time, its position is unambiguous ("global" decoding).
+// After that each new frame is decoded relative to the aircraft's own last
+// position - which, unlike our location, cannot be half a zone away.
+// The frames are kept in the traffic table, see update_traffic_position().
+//
+
+static int cprModInt(int a, int b)
+{
+    int res = a % b;
+    if (res < 0)
+        res += b;
+    return res;
+}
+
+// decode mm relative to a given location
+static bool decodeCPRlocal(int32_t lat, int32_t lon)
+{
+    int f = mm.fflag;
+    int32_t rlat = zone2bam(cpr_nearest(bam2zone(lat, 60-f), mm.cprlat), 60-f);
+    uint32_t absrlat = absbam(rlat);
+    if (absrlat > NLbam[0])
+        return false;
+    int NL2 = cprNLFunction_(absrlat);
+    int ni = cprNi(f, NL2);
+    int32_t rlon = zone2bam(cpr_nearest(bam2zone(lon, ni), mm.cprlon), ni);
+
+    mm.latbam = rlat;
+    mm.lonbam = rlon;
+    fo.latitude  = rlat * (float) BAM2DEG;
+    fo.longitude = rlon * (float) BAM2DEG;
+    return true;
+}
+
+// decode mm along with the frame of the other parity kept in *fop
+static bool decodeCPRglobal(const cpr_track_t *fop)
+{
+    int f = mm.fflag;
+    int32_t lat0, lat1, lon0, lon1;     // even, odd
+    if (f) {
+        lat0 = cpr_lat(fop, 0);    lon0 = cpr_lon(fop, 0);
+        lat1 = mm.cprlat;          lon1 = mm.cprlon;
+    } else {
+        lat0 = mm.cprlat;          lon0 = mm.cprlon;
+        lat1 = cpr_lat(fop, 1);    lon1 = cpr_lon(fop, 1);
+    }
+
+    // Compute the Latitude Index "j" = floor((59*lat0 - 60*lat1)/2^17 + 0.5)
+    // - the binary angles wrap around from 270..360 to -90..0 by themselves
+    int j = (59*lat0 - 60*lat1 + (1<<16)) >> 17;
+    int32_t rlat0 = zone2bam(cprModInt(j, 60) * (1<<17) + lat0, 60);
+    int32_t rlat1 = zone2bam(cprModInt(j, 59) * (1<<17) + lat1, 59);
+    if (absbam(rlat0) > NLbam[0] || absbam(rlat1) > NLbam[0])
+        return false;
+
+    // both frames must be in the same NL zone, else wait for another pair
+    int NL2 = cprNLFunction_(absbam(rlat0));
+    if (cprNLFunction_(absbam(rlat1)) != NL2)
+        return false;
+
+    // Compute the Longitude Index "m", with the latest frame's zone count
+    int ni = cprNi(f, NL2);
+    int m = (lon0 * (NL2-1) - lon1 * NL2 + (1<<16)) >> 17;
+    int32_t rlon = zone2bam(cprModInt(m, ni) * (1<<17) + (f ? lon1 : lon0), ni);
+
+    mm.latbam = (f ? rlat1 : rlat0);
+    mm.lonbam = rlon;
+    fo.latitude  = mm.latbam * (float) BAM2DEG;
+    fo.longitude = rlon * (float) BAM2DEG;
+    return true;
+}
+
+// a position in degrees as binary angles - longitude via half of it, so
+//   that +180 does not overflow an int32_t before it wraps around to -180
+static inline int32_t lat2bam(float lat)
+{
+    return (int32_t) (lat * (float) DEG2BAM);
+}
+
+static inline int32_t lon2bam(float lon)
+{
+    return (int32_t) ((uint32_t) (int32_t) (lon * (float) (DEG2BAM/2)) << 1);
+}
+
+// decode the position in mm for aircraft fo.addr - from its own earlier
+// frames if possible, else relative to our location
+int decodeCPR(const cprref_t *ref)
+{
+    int i = find_traffic_by_addr(fo.addr);
+    if (i != 0) {
+        const cpr_track_t *fop = traffic_cpr(i-1);
+        uint32_t now = millis();
+        uint32_t age = cpr_age(fop, 0, now);        // since the latest frame
+        if (cpr_age(fop, 1, now) < age)
+            age = cpr_age(fop, 1, now);
+        if ((fop->cprflags & CPR_FIX) && age < CPR_LOCAL_MS
+              && decodeCPRlocal(lat2bam(fop->latitude), lon2bam(fop->longitude))) {
+            ++msg_by_cpr_method[1];
+            fo.cprflags = CPR_FIX;
+            return 0;
+        }
+        int other = (mm.fflag ? CPR_EVEN : CPR_ODD);
+        if ((fop->cprflags & other) && cpr_age(fop, mm.fflag ^ 1, now) < CPR_PAIR_MS) {
+            if (decodeCPRglobal(fop)) {
+                ++msg_by_cpr_method[2];
+                fo.cprflags = CPR_FIX;
+                return 0;
+            }
+            ++msg_by_cpr_method[3];
+        }
+    }
+    fo.cprflags = 0;
+    int effort = decodeCPRrelative(ref);
+    if (effort >= 0)
+        ++msg_by_cpr_method[0];
+    return effort;
+}
+
+//
+//=========================================================================
+//
+// Surface positions (TC 5-8) carry the same 17-bit CPR fractions, but of
+// zones a quarter the size: 90/60 (or 90/59) degrees of latitude, and 90/NL
+// (or 90/(NL-1)) degrees of longitude.  In zone units that is 2^2 times as
+// many per binary angle, hence these variants of bam2zone() and zone2bam().
+// Even an odd/even pair leaves the quadrant open, which is then taken as the
+// one nearest our location.
+//
+
+static inline int32_t bam2zone_s(int32_t bam, int nz)
+{
+    return (int32_t) (((int64_t) bam * nz + (1<<12)) >> 13);
+}
+
+static inline int32_t zone2bam_s(int32_t z, int nz)
+{
+    return (int32_t) (((int64_t) z * zoneK[nz]) >> 18);
+}
+
+// the one of bam + k * 90 degrees nearest to ref
+static inline int32_t nearest_quadrant(int32_t bam, int32_t ref)
+{
+    uint32_t d = (uint32_t) ref - (uint32_t) bam + (1<<29);
+    return (int32_t) ((uint32_t) bam + (d & 0xC0000000));
+}
+
+// decode mm relative to a given location, less than 1/2 (surface) zone away
+static bool decodeSurfacelocal(int32_t lat, int32_t lon)
+{
+    int f = mm.fflag;
+    int32_t rlat = zone2bam_s(cpr_nearest(bam2zone_s(lat, 60-f), mm.cprlat), 60-f);
+    uint32_t absrlat = absbam(rlat);
+    if (absrlat > NLbam[0])
+        return false;
+    int ni = cprNi(f, cprNLFunction_(absrlat));
+    int32_t rlon = zone2bam_s(cpr_nearest(bam2zone_s(lon, ni), mm.cprlon), ni);
+
+    mm.latbam = rlat;
+    mm.lonbam = rlon;
+    fo.latitude  = rlat * (float) BAM2DEG;
+    fo.longitude = rlon * (float) BAM2DEG;
+    return true;
+}
+
+// decode mm along with the frame of the other parity kept in *fop, as in
+// decodeCPRglobal(), then choose the quadrants nearest to ref
+static bool decodeSurfaceglobal(const cpr_track_t *fop, const cprref_t *ref)
+{
+    int f = mm.fflag;
+    int32_t lat0, lat1, lon0, lon1;     // even, odd
+    if (f) {
+        lat0 = cpr_lat(fop, 0);    lon0 = cpr_lon(fop, 0);
+        lat1 = mm.cprlat;          lon1 = mm.cprlon;
+    } else {
+        lat0 = mm.cprlat;          lon0 = mm.cprlon;
+        lat1 = cpr_lat(fop, 1);    lon1 = cpr_lon(fop, 1);
+    }
+
+    // both latitudes come out 0..90 degrees, north or south of the equator
+    // - the southern one unless ours is more than 45 degrees away from it
+    int j = (59*lat0 - 60*lat1 + (1<<16)) >> 17;
+    int32_t rlat0 = zone2bam_s(cprModInt(j, 60) * (1<<17) + lat0, 60);
+    int32_t rlat1 = zone2bam_s(cprModInt(j, 59) * (1<<17) + lat1, 59);
+    if (ref->reflatbam - rlat0 < -(1<<29)) {
+        rlat0 -= (1<<30);
+        rlat1 -= (1<<30);
+    }
+    if (absbam(rlat0) > NLbam[0] || absbam(rlat1) > NLbam[0])
+        return false;
+    int NL2 = cprNLFunction_(absbam(rlat0));
+    if (cprNLFunction_(absbam(rlat1)) != NL2)
+        return false;
+
+    int ni = cprNi(f, NL2);
+    int m = (lon0 * (NL2-1) - lon1 * NL2 + (1<<16)) >> 17;
+    int32_t rlon = zone2bam_s(cprModInt(m, ni) * (1<<17) + (f ? lon1 : lon0), ni);
+
+    mm.latbam = (f ? rlat1 : rlat0);
+    mm.lonbam = nearest_quadrant(rlon, ref->reflonbam);
+    fo.latitude  = mm.latbam * (float) BAM2DEG;
+    fo.longitude = mm.lonbam * (float) BAM2DEG;
+    return true;
+}
+
+// decode the surface position in mm for aircraft fo.addr - the same ways
+// as decodeCPR(), but relative to our location only within 1/2 zone, 45 nm
+// in latitude, which is as far as traffic on the ground can be heard from
+// anywhere near the ground.  Returns 0, or -1 if no position.
+int decodeCPRsurface(const cprref_t *ref)
+{
+    int i = find_traffic_by_addr(fo.addr);
+    if (i != 0) {
+        const cpr_track_t *fop = traffic_cpr(i-1);
+        uint32_t now = millis();
+        uint32_t age = cpr_age(fop, 0, now);
+        if (cpr_age(fop, 1, now) < age)
+            age = cpr_age(fop, 1, now);
+        if ((fop->cprflags & CPR_FIX) && age < CPR_LOCAL_MS
+              && decodeSurfacelocal(lat2bam(fop->latitude), lon2bam(fop->longitude))) {
+            ++msg_by_cpr_method[1];
+            fo.cprflags = CPR_FIX;
+            return 0;
+        }
+        int other = (mm.fflag ? CPR_EVEN : CPR_ODD);
+        if ((fop->cprflags & other) && cpr_age(fop, mm.fflag ^ 1, now) < CPR_PAIR_MS) {
+            if (decodeSurfaceglobal(fop, ref)) {
+                ++msg_by_cpr_method[2];
+                fo.cprflags = CPR_FIX;
+                return 0;
+            }
+            ++msg_by_cpr_method[3];
+        }
+    }
+    fo.cprflags = 0;
+    if (! decodeSurfacelocal(ref->reflatbam, ref->reflonbam)) {
+        ++msg_by_cpr_effort[3];
+        return (-1);
+    }
+    ++msg_by_cpr_method[0];
+    return 0;
+}
+
+
+// pre-compute all that is possible just based on a reference lat/lon
+static void CPRRelative_build(cprref_t *r, float lat, float lon)
+{
     // (two each: odd and even versions)
 
-    // float dLat[2];     // degrees interval one zone covers - constant
-    // float flrlat[2];   // floor(reflat / dLat) - i.e., zone index (integer value)
-    // float modlat[2];   // mod(reflat,dLat)/dLat = reflat/dLat - flrlat[] - i.e., fraction
-                          // - because mod(x,y) is defined as: x - y * floor(x/y)
-    // uint32_t cprlat    // the "fraction" times 2^17 - this is what is transmitted
-    // int NL[2];         // number of longitude zones: fewer at higher latitudes
-    // float dLon[2];     // size of degrees interval one zone covers
-    // float flrlon[2];   // floor(reflon / dLon) - i.e., zone index
-    // float modlon[2];   // mod(reflon,dLon)/dLon = reflon/dLon - flrlon[] - i.e., fraction
-    // uint32_t cprlon    // the "fraction" times 2^17
+    // int32_t reflatz[2];  // our latitude in zone units (see above) - there are
+                            //   60 (even) or 59 (odd) zones, each dLat degrees
+    // uint32_t ourcprlat   // the "fraction" times 2^17 - this is what is transmitted
+    // int NL[2];           // number of longitude zones: fewer at higher latitudes
+    // int32_t reflonz[2];  // our longitude in zone units, for NL zones (NL-1 if odd)
+    // uint32_t ourcprlon   // the "fraction" times 2^17
 
-    reflat = settings->latitude;
-    reflon = settings->longitude;
+    r->reflat = lat;
+    r->reflon = lon;
+    r->reflatbam = (int32_t) (lat * DEG2BAM);
+    r->reflonbam = (int32_t) (int64_t) (lon * DEG2BAM);     // 180 wraps around to -180
+#if defined(DSTBRG_GRID)
+    r->coslat = (int32_t) (cos(lat * (M_PI / 180.0)) * 65536.0 + 0.5);
+#endif
 
     for (int k=0; k<2; k++) {  // odd/even
-        float invdLat = (k ? 59.0/360.0 : 60.0/360.0);
-        // float scaled = reflat / dLat[k];
-        float scaled = reflat * invdLat;
-        flrlat[k] = floor(scaled);
-        modlat[k] = scaled - flrlat[k];
-        float lat0 = dLat[k] * flrlat[k];
-        ourcprlat[k] = (uint32_t) ((reflat - lat0)/dLat[k] * (float)(1<<17) + 0.5);
-        NL[k] = cprNLFunction(reflat);
+        int nz = 60 - k;
+        r->reflatz[k] = bam2zone(r->reflatbam, nz);
+        r->ourcprlat[k] = (r->reflatz[k] & 0x1FFFF);
+        int32_t lat0z = r->reflatz[k] - r->ourcprlat[k];    // the edge of our zone
+        int NL = cprNLFunction(r->reflatbam);
+        r->NL[k] = NL;
 
         // <<< need to compute NL based on target lat which is not known yet -
         // but when target is close NL is the same, so precompute on speculation
         // - see above in decodeCPRrelative() how this is used
-        dLon[k] = cprDlonFunction(k, NL[k]);
-        scaled = reflon * cprDlonInvFunction(k, NL[k]);
-        flrlon[k] = floor(scaled);
-        modlon[k] = scaled - flrlon[k];
-        ourcprlon[k] = (uint32_t) ((reflon - dLon[k]*flrlon[k])/dLon[k] * (float)(1<<17) + 0.5);
+        r->reflonz[k] = bam2zone(r->reflonbam, cprNi(k, NL));
+        r->ourcprlon[k] = (r->reflonz[k] & 0x1FFFF);
 
         // pre-compute cpr values for latitudes at both edges of adjacent NL zones
         // - to allow parse() to detect the zone and compute the distance early
         //     - latitude is lower for higher NL
-        //     - our lat is < NLtable[NL[k]], and >= NLtable[NL[k]+1]
+        //     - our lat is < NLtable[NL], and >= NLtable[NL+1]
         // note these out-of-bounds cpr values are signed!
-        float edgelat = NLtable[NL[k]-1];
-        if (reflat < 0)  edgelat = -edgelat;
-        cprMinuslat[k] = (int32_t)((edgelat-lat0) / dLat[k] * (float)(1<<17) + 0.5);
-        edgelat = NLtable[NL[k]];
-        if (reflat < 0)  edgelat = -edgelat;
-        cprNL0lat[k] = (int32_t)((edgelat-lat0) / dLat[k] * (float)(1<<17) + 0.5);
-        edgelat = NLtable[NL[k]+1];
-        if (reflat < 0)  edgelat = -edgelat;
-        cprNL1lat[k] = (int32_t)((edgelat-lat0) / dLat[k] * (float)(1<<17) + 0.5);
-        edgelat = NLtable[NL[k]+2];
-        if (reflat < 0)  edgelat = -edgelat;
-        cprPluslat[k] = (int32_t)((edgelat-lat0) / dLat[k] * (float)(1<<17) + 0.5);
+        int32_t sign = (lat < 0 ? -1 : 1);
+        r->cprMinuslat[k] = bam2zone(sign * (int32_t) NLbam[NL-1], nz) - lat0z;
+        r->cprNL0lat[k]   = bam2zone(sign * (int32_t) NLbam[NL],   nz) - lat0z;
+        r->cprNL1lat[k]   = bam2zone(sign * (int32_t) NLbam[NL+1], nz) - lat0z;
+        r->cprPluslat[k]  = bam2zone(sign * (int32_t) NLbam[NL+2], nz) - lat0z;
 
         // pre-compute some other values for adjacent NL zones
 
-        int NL2 = NL[k] + 1;
-        dLonPlus[k] = cprDlonFunction(k, NL2);
-        dLonHalf = 0.5 * dLonPlus[0];      // for both odd and even, this value is conservative
-        scaled = reflon * cprDlonInvFunction(k, NL2);
-        flrlonPlus[k] = floor(scaled);
-        modlonPlus[k] = scaled - flrlonPlus[k];
-        ourcprlonPlus[k] = (uint32_t) ((reflon - dLonPlus[k]*flrlonPlus[k])/dLonPlus[k] * (float)(1<<17) + 0.5);
-
-        NL2 = NL[k] - 1;
-        dLonMinus[k] = cprDlonFunction(k, NL2);
-        scaled = reflon * cprDlonInvFunction(k, NL2);
-        flrlonMinus[k] = floor(scaled);
-        modlonMinus[k] = scaled - flrlonMinus[k];
-        ourcprlonMinus[k] = (uint32_t) ((reflon - dLonMinus[k]*flrlonMinus[k])/dLonMinus[k] * (float)(1<<17) + 0.5);
+        r->reflonzPlus[k] = bam2zone(r->reflonbam, cprNi(k, NL+1));
+        r->ourcprlonPlus[k] = (r->reflonzPlus[k] & 0x1FFFF);
+
+        r->reflonzMinus[k] = bam2zone(r->reflonbam, cprNi(k, (NL > 1 ? NL-1 : 1)));
+        r->ourcprlonMinus[k] = (r->reflonzMinus[k] & 0x1FFFF);
+    }
+}
+
+static uint32_t cpr_switch_ms;     // millis() when cprref last changed
+
+// Build the reference for a new position in the buffer not in use, then
+// switch to it with a single store.  The receive task reads cprref once per
+// message, so it sees either the old reference or the new one, never a mix.
+// The old one is not written into until the switch after next, at least
+// CPR_REF_MS later, long after any message that was using it is done.
+static void CPRRelative_switch(float lat, float lon)
+{
+    cprref_t *r = (cprref == &cprrefs[0] ? &cprrefs[1] : &cprrefs[0]);
+    CPRRelative_build(r, lat, lon);
+    __atomic_store_n(&cprref, r, __ATOMIC_RELEASE);
+    cpr_switch_ms = millis();
+    ++cpr_rebuilds;
+}
+
+// our position from the settings - at setup, and by the LOC command
+void CPRRelative_precomp()
+{
+    CPRRelative_switch(settings->latitude, settings->longitude);
 
 #if defined(TESTING)
+    const cprref_t *r = cprref;
+    for (int k=0; k<2; k++) {  // odd/even
 if(settings->debug) {
-        Serial.printf("[%d] dLat           = %f\n", k, dLat[k]);
-        Serial.printf("[%d] flrlat         = %f\n", k, flrlat[k]);
-        Serial.printf("[%d] modlat         = %f\n", k, modlat[k]);
-        Serial.printf("[%d] ourcprlat      = %d\n", k, ourcprlat[k]);
-        Serial.printf("[%d] cprMinuslat    = %d\n", k, cprMinuslat[k]);
-        Serial.printf("[%d] cprNL0lat      = %d\n", k, cprNL0lat[k]);
-        Serial.printf("[%d] cprNL1lat      = %d\n", k, cprNL1lat[k]);
-        Serial.printf("[%d] cprPluslat     = %d\n", k, cprPluslat[k]);
-        Serial.printf("[%d] dLon           = %f\n", k, dLon[k]);
-        Serial.printf("[%d] dLonPlus       = %f\n", k, dLonPlus[k]);
-        Serial.printf("[%d] dLonMinus      = %f\n", k, dLonMinus[k]);
-        Serial.printf("[%d] flrlon         = %f\n", k, flrlon[k]);
-        Serial.printf("[%d] flrlonPlus     = %f\n", k, flrlonPlus[k]);
-        Serial.printf("[%d] flrlonMinus    = %f\n", k, flrlonMinus[k]);
-        Serial.printf("[%d] modlon         = %f\n", k, modlon[k]);
-        Serial.printf("[%d] modlonPlus     = %f\n", k, modlonPlus[k]);
-        Serial.printf("[%d] modlonMinus    = %f\n", k, modlonMinus[k]);
-        Serial.printf("[%d] ourcprlon      = %d\n", k, ourcprlon[k]);
-        Serial.printf("[%d] ourcprlonPlus  = %d\n", k, ourcprlonPlus[k]);
-        Serial.printf("[%d] ourcprlonMinus = %d\n", k, ourcprlonMinus[k]);
+        Serial.printf("[%d] NL             = %d\n", k, r->NL[k]);
+        Serial.printf("[%d] reflatz        = %d\n", k, r->reflatz[k]);
+        Serial.printf("[%d] ourcprlat      = %d\n", k, r->ourcprlat[k]);
+        Serial.printf("[%d] cprMinuslat    = %d\n", k, r->cprMinuslat[k]);
+        Serial.printf("[%d] cprNL0lat      = %d\n", k, r->cprNL0lat[k]);
+        Serial.printf("[%d] cprNL1lat      = %d\n", k, r->cprNL1lat[k]);
+        Serial.printf("[%d] cprPluslat     = %d\n", k, r->cprPluslat[k]);
+        Serial.printf("[%d] reflonz        = %d\n", k, r->reflonz[k]);
+        Serial.printf("[%d] reflonzPlus    = %d\n", k, r->reflonzPlus[k]);
+        Serial.printf("[%d] reflonzMinus   = %d\n", k, r->reflonzMinus[k]);
+        Serial.printf("[%d] ourcprlon      = %d\n", k, r->ourcprlon[k]);
+        Serial.printf("[%d] ourcprlonPlus  = %d\n", k, r->ourcprlonPlus[k]);
+        Serial.printf("[%d] ourcprlonMinus = %d\n", k, r->ourcprlonMinus[k]);
 }
         // test the computation of our cprlat/lon along with the decoding:
-        mm.cprlat = ourcprlat[k];
-        mm.cprlon = ourcprlon[k];
+        mm.cprlat = r->ourcprlat[k];
+        mm.cprlon = r->ourcprlon[k];
         mm.fflag = k;
-        decodeCPRrelative();
-        Serial.printf("[%d] Reference latitude/longitude: %.5f, %.5f\n", k, reflat, reflon);
+        decodeCPRrelative(r);
+        Serial.printf("[%d] Reference latitude/longitude: %.5f, %.5f\n", k, r->reflat, r->reflon);
         Serial.printf("[%d]    -> Test pre-comp & decode: %.5f, %.5f\n", k, fo.latitude, fo.longitude);
-#endif
     }
+#endif
+}
+
+// Our position from an own-ship GNSS receiver, about once a second (see
+// gnss.cpp).  What is precomputed only changes once we have moved some
+// part of a CPR zone, so the reference is not rebuilt until then, and not
+// more often than every CPR_REF_MS - returns whether it was rebuilt.
+bool CPRRelative_update(float lat, float lon)
+{
+    if (millis() - cpr_switch_ms < CPR_REF_MS)
+        return false;
+    const cprref_t *ref = cprref;
+    int32_t dlat = (int32_t) ((uint32_t) lat2bam(lat) - (uint32_t) ref->reflatbam);
+    int32_t dlon = (int32_t) ((uint32_t) lon2bam(lon) - (uint32_t) ref->reflonbam);
+    if (abs(bam2zone(dlat, 60)) < CPR_REF_MOVE
+          && abs(bam2zone(dlon, cprNi(0, ref->NL[0]))) < CPR_REF_MOVE)
+        return false;
+    CPRRelative_switch(lat, lon);
+    return true;
 }
 
 void CPRRelative_setup()
 {
     // prepare lookup tables
-    for (int i=1; i<60; i++) {    // yes we skip [0] which is not used
-        dLonTable[i] = 360.0/i;
-        dLonInvTable[i] = i/360.0;
-    }
+    // - rounded up, so that (lat < NLbam[i]) is exactly (degrees < NLtable[i])
+    for (int i=0; i<61; i++)
+        NLbam[i] = (uint32_t) ceil(NLtable[i] * DEG2BAM);
+    NLbam[61] = 0;
+    for (int i=0; i<=256; i++)
+        NLslice[i] = cprNLsearch((uint32_t) i << 22, 1, 59);
+    for (int i=1; i<=60; i++)     // yes we skip [0] which is not used
+        zoneK[i] = (uint32_t) ((2147483648.0 + (i>>1)) / i);
 
-    // these do not change
-    dLat[0] = 360.0/60.0;
-    dLat[1] = 360.0/59.0;
-    // for both odd and even, this value is conservative:
-    dLatHalf = 0.5 * dLat[0];
     // first-cut range limit (along each axis):
     maxcprdiff = (int32_t)((float)(1<<16) * (float)settings->maxrange / 180.0);
     // a squared scaled version for slant distance
     maxcprdiff_sq = (maxcprdiff >> 4) * (maxcprdiff >> 4);
-    
 
     // compute what does depend on reflat, reflon
     CPRRelative_precomp();
+
+#if defined(DSTBRG_GRID)
+    dstbrg_setup();
+#endif
 }
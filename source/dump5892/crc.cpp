@@ -10,6 +10,8 @@
 
 // This code from https://github.com/watson/libmodes/
 
+#include <stdlib.h>
+
 #include "dump5892.h"
 
 // Parity table for MODE S Messages.
@@ -30,7 +32,7 @@
 // xored with the sender address as they are reply to interrogations, but a
 // casual listener can't split the address from the checksum.
 
-static uint32_t mode_s_checksum_table[] = {
+static const uint32_t mode_s_checksum_table[] = {
   0x3935ea, 0x1c9af5, 0xf1b77e, 0x78dbbf, 0xc397db, 0x9e31e9, 0xb0e2f0, 0x587178,
   0x2c38bc, 0x161c5e, 0x0b0e2f, 0xfa7d13, 0x82c48d, 0xbe9842, 0x5f4c21, 0xd05c14,
   0x682e0a, 0x341705, 0xe5f186, 0x72f8c3, 0xc68665, 0x9cb936, 0x4e5c9b, 0xd8d449,
@@ -47,16 +49,80 @@ static uint32_t mode_s_checksum_table[] = {
   0x000000, 0x000000, 0x000000, 0x000000, 0x000000, 0x000000, 0x000000, 0x000000
 };
 
-static uint32_t mode_s_checksum( int n ) {
+// Byte-at-a-time version of the same computation.
+//
+// The parity table above is just the remainders of x^k modulo the Mode S
+// generator polynomial (0x1FFF409) for each bit position, so the checksum
+// is an ordinary MSB-first CRC-24 over the data bytes (the last 3 bytes are
+// the PI field and are not included).  This table holds the remainder for
+// each possible value of the next byte XORed into the top 8 bits of the CRC,
+// so that a whole byte is processed with one lookup instead of 8 bit tests.
+// Results are bit-identical to the bit-serial loop, for 56 and 112 bit frames
+// alike, since leading zero bits do not change a CRC remainder.
+//
+// Being const, the 1 KB table stays in flash on the ESP32.
 
-  int bits = n * 8;
+static const uint32_t mode_s_crc_table[256] = {
+  0x000000, 0xfff409, 0x001c1b, 0xffe812, 0x003836, 0xffcc3f, 0x00242d, 0xffd024,
+  0x00706c, 0xff8465, 0x006c77, 0xff987e, 0x00485a, 0xffbc53, 0x005441, 0xffa048,
+  0x00e0d8, 0xff14d1, 0x00fcc3, 0xff08ca, 0x00d8ee, 0xff2ce7, 0x00c4f5, 0xff30fc,
+  0x0090b4, 0xff64bd, 0x008caf, 0xff78a6, 0x00a882, 0xff5c8b, 0x00b499, 0xff4090,
+  0x01c1b0, 0xfe35b9, 0x01ddab, 0xfe29a2, 0x01f986, 0xfe0d8f, 0x01e59d, 0xfe1194,
+  0x01b1dc, 0xfe45d5, 0x01adc7, 0xfe59ce, 0x0189ea, 0xfe7de3, 0x0195f1, 0xfe61f8,
+  0x012168, 0xfed561, 0x013d73, 0xfec97a, 0x01195e, 0xfeed57, 0x010545, 0xfef14c,
+  0x015104, 0xfea50d, 0x014d1f, 0xfeb916, 0x016932, 0xfe9d3b, 0x017529, 0xfe8120,
+  0x038360, 0xfc7769, 0x039f7b, 0xfc6b72, 0x03bb56, 0xfc4f5f, 0x03a74d, 0xfc5344,
+  0x03f30c, 0xfc0705, 0x03ef17, 0xfc1b1e, 0x03cb3a, 0xfc3f33, 0x03d721, 0xfc2328,
+  0x0363b8, 0xfc97b1, 0x037fa3, 0xfc8baa, 0x035b8e, 0xfcaf87, 0x034795, 0xfcb39c,
+  0x0313d4, 0xfce7dd, 0x030fcf, 0xfcfbc6, 0x032be2, 0xfcdfeb, 0x0337f9, 0xfcc3f0,
+  0x0242d0, 0xfdb6d9, 0x025ecb, 0xfdaac2, 0x027ae6, 0xfd8eef, 0x0266fd, 0xfd92f4,
+  0x0232bc, 0xfdc6b5, 0x022ea7, 0xfddaae, 0x020a8a, 0xfdfe83, 0x021691, 0xfde298,
+  0x02a208, 0xfd5601, 0x02be13, 0xfd4a1a, 0x029a3e, 0xfd6e37, 0x028625, 0xfd722c,
+  0x02d264, 0xfd266d, 0x02ce7f, 0xfd3a76, 0x02ea52, 0xfd1e5b, 0x02f649, 0xfd0240,
+  0x0706c0, 0xf8f2c9, 0x071adb, 0xf8eed2, 0x073ef6, 0xf8caff, 0x0722ed, 0xf8d6e4,
+  0x0776ac, 0xf882a5, 0x076ab7, 0xf89ebe, 0x074e9a, 0xf8ba93, 0x075281, 0xf8a688,
+  0x07e618, 0xf81211, 0x07fa03, 0xf80e0a, 0x07de2e, 0xf82a27, 0x07c235, 0xf8363c,
+  0x079674, 0xf8627d, 0x078a6f, 0xf87e66, 0x07ae42, 0xf85a4b, 0x07b259, 0xf84650,
+  0x06c770, 0xf93379, 0x06db6b, 0xf92f62, 0x06ff46, 0xf90b4f, 0x06e35d, 0xf91754,
+  0x06b71c, 0xf94315, 0x06ab07, 0xf95f0e, 0x068f2a, 0xf97b23, 0x069331, 0xf96738,
+  0x0627a8, 0xf9d3a1, 0x063bb3, 0xf9cfba, 0x061f9e, 0xf9eb97, 0x060385, 0xf9f78c,
+  0x0657c4, 0xf9a3cd, 0x064bdf, 0xf9bfd6, 0x066ff2, 0xf99bfb, 0x0673e9, 0xf987e0,
+  0x0485a0, 0xfb71a9, 0x0499bb, 0xfb6db2, 0x04bd96, 0xfb499f, 0x04a18d, 0xfb5584,
+  0x04f5cc, 0xfb01c5, 0x04e9d7, 0xfb1dde, 0x04cdfa, 0xfb39f3, 0x04d1e1, 0xfb25e8,
+  0x046578, 0xfb9171, 0x047963, 0xfb8d6a, 0x045d4e, 0xfba947, 0x044155, 0xfbb55c,
+  0x041514, 0xfbe11d, 0x04090f, 0xfbfd06, 0x042d22, 0xfbd92b, 0x043139, 0xfbc530,
+  0x054410, 0xfab019, 0x05580b, 0xfaac02, 0x057c26, 0xfa882f, 0x05603d, 0xfa9434,
+  0x05347c, 0xfac075, 0x052867, 0xfadc6e, 0x050c4a, 0xfaf843, 0x051051, 0xfae458,
+  0x05a4c8, 0xfa50c1, 0x05b8d3, 0xfa4cda, 0x059cfe, 0xfa68f7, 0x0580e5, 0xfa74ec,
+  0x05d4a4, 0xfa20ad, 0x05c8bf, 0xfa3cb6, 0x05ec92, 0xfa189b, 0x05f089, 0xfa0480
+};
 
-  if (bits != 56 && bits != 112) {
+static uint32_t mode_s_checksum( int n ) {
+
+  if (n != 7 && n != 14) {
 if(settings->debug>1)
-Serial.printf("mode_s_checksum(): %d bits?\n", bits);
+Serial.printf("mode_s_checksum(): %d bits?\n", n * 8);
       return 0xFFFFFF;   // not 0
   }
 
+  uint32_t crc = 0;
+  n -= 3;          // skip the parity bytes
+  const byte *p = msg;
+  while (n-- > 0)
+      crc = ((crc << 8) & 0xFFFFFF) ^ mode_s_crc_table[((crc >> 16) ^ *p++) & 0xFF];
+
+  return crc; // 24 bit checksum.
+}
+
+#if defined(TESTING)
+// the original bit-serial version, kept as a reference for cross-checking
+uint32_t mode_s_checksum_bitwise( int n ) {
+
+  int bits = n * 8;
+
+  if (bits != 56 && bits != 112)
+      return 0xFFFFFF;   // not 0
+
   uint32_t crc = 0;
   int offset = ((bits == 112) ? 0 : (112-56));
   int j;
@@ -70,10 +136,6 @@ Serial.printf("mode_s_checksum(): %d bits?\n", bits);
   int bitmask = (1 << 7);
   for(j = 0; j < bits; /*j++*/) {
 
-    //int byte = j/8;
-    //int bit = j%8;
-    //int bitmask = 1 << (7-bit);
-
     // If bit is set, xor with corresponding table entry.
     if (msg[byte] & bitmask)
       crc ^= mode_s_checksum_table[j+offset];
@@ -89,6 +151,7 @@ Serial.printf("mode_s_checksum(): %d bits?\n", bits);
 
   return crc; // 24 bit checksum.
 }
+#endif
 
 uint32_t check_crc( int n )
 {
@@ -101,3 +164,118 @@ if(settings->debug>1 && crc != crc2)
 Serial.printf("checkcrc(): %06X -> %06X (XORed: %06X)\n", crc, crc2, crc^crc2);
   return (crc ^ crc2);
 }
+
+// Error correction for DF17/18 by syndrome lookup.
+//
+// A single bit error at (0-based) position j of a 112-bit frame changes the
+// result of check_crc() - the "syndrome" - into mode_s_checksum_table[j] for
+// the data bits, or into the flipped bit itself for the 24 parity bits.
+// A double error gives the XOR of two such values.  For the 107 bit positions
+// after the DF field all of these 1- and 2-bit syndromes are distinct (and
+// non-zero), so a lookup of the syndrome identifies the error bits uniquely.
+// The DF field itself is never "corrected", that could turn some other frame
+// type into an ES.
+//
+// The index is kept sorted by syndrome, for a binary search.  With 2-bit
+// correction it has 5778 entries of 6 bytes each, so it is only allocated
+// when that correction depth is selected.
+
+#define FIX_FIRST_BIT 5          // skip the DF field
+
+typedef struct fix_entry {
+    uint32_t syndrome;
+    uint16_t bits;               // (bit1+1) | ((bit2+1) << 8), bit2+1 = 0 if single
+} __attribute__((packed)) fix_entry_t;
+
+static fix_entry_t *fix_index = NULL;
+static int fix_count = 0;
+static int fix_depth = 0;
+
+static uint32_t bit_syndrome(int j)
+{
+    if (j < 112-24)
+        return mode_s_checksum_table[j];
+    return (1 << (111-j));       // a parity bit
+}
+
+static int fix_compare(const void *a, const void *b)
+{
+    uint32_t sa = ((const fix_entry_t *) a)->syndrome;
+    uint32_t sb = ((const fix_entry_t *) b)->syndrome;
+    return (sa < sb ? -1 : sa > sb ? 1 : 0);
+}
+
+// (re)build the syndrome index for the given correction depth (0, 1 or 2)
+void crc_fix_setup(int depth)
+{
+    if (depth == fix_depth && (depth == 0 || fix_index != NULL))
+        return;
+    if (fix_index != NULL) {
+        free(fix_index);
+        fix_index = NULL;
+    }
+    fix_count = 0;
+    fix_depth = 0;
+    if (depth <= 0)
+        return;
+    if (depth > 2)
+        depth = 2;
+    int nbits = 112 - FIX_FIRST_BIT;
+    int size = nbits;
+    if (depth == 2)
+        size += (nbits * (nbits-1)) / 2;
+    fix_index = (fix_entry_t *) malloc(size * sizeof(fix_entry_t));
+    if (fix_index == NULL && depth == 2) {
+        Serial.println("\n>>>> Not enough memory for 2-bit CRC correction, using 1-bit\n");
+        depth = 1;
+        size = nbits;
+        fix_index = (fix_entry_t *) malloc(size * sizeof(fix_entry_t));
+    }
+    if (fix_index == NULL)
+        return;
+    int k = 0;
+    for (int i=FIX_FIRST_BIT; i<112; i++) {
+        fix_index[k].syndrome = bit_syndrome(i);
+        fix_index[k].bits = (i+1);
+        ++k;
+        if (depth < 2)
+            continue;
+        for (int j=i+1; j<112; j++) {
+            fix_index[k].syndrome = bit_syndrome(i) ^ bit_syndrome(j);
+            fix_index[k].bits = (i+1) | ((j+1) << 8);
+            ++k;
+        }
+    }
+    qsort(fix_index, k, sizeof(fix_entry_t), fix_compare);
+    fix_count = k;
+    fix_depth = depth;
+if(settings->debug)
+Serial.printf("CRC correction index: %d entries, %d bytes\n", k, (int)(k * sizeof(fix_entry_t)));
+}
+
+// try and correct a 112-bit frame in msg[] given its nonzero syndrome
+// returns the number of bits corrected (1 or 2), or 0 if not correctable
+int fix_crc(uint32_t syndrome)
+{
+    int lo = 0;
+    int hi = fix_count - 1;
+    while (lo <= hi) {
+        int mid = ((lo + hi) >> 1);
+        uint32_t s = fix_index[mid].syndrome;
+        if (s < syndrome) {
+            lo = mid + 1;
+        } else if (s > syndrome) {
+            hi = mid - 1;
+        } else {
+            uint16_t bits = fix_index[mid].bits;
+            int j = (bits & 0xFF) - 1;
+            msg[j >> 3] ^= (1 << (7 - (j & 7)));
+            j = (bits >> 8) - 1;
+            if (j < 0)
+                return 1;
+            msg[j >> 3] ^= (1 << (7 - (j & 7)));
+            return 2;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,114 @@
+/*
+ * dstbrg.cpp - distance and bearing by table lookup
+ * Copyright (C) 2024 Moshe Braner
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version - see <http://www.gnu.org/licenses/>.
+ */
+
+// The distance and bearing from our location to a decoded position, on a
+// flat earth as before, without any division: the offset north (y) and east
+// (x) is worked out in integers from the binary angles, and then the
+// hypotenuse and the angle are looked up in a grid of precomputed values
+// over a quadrant, with bilinear interpolation between the grid points.
+//
+// Distance and bearing both scale simply with the offset - the former in
+// proportion, the latter not at all.  So the offset is first scaled (by a
+// power of 2) to where max(|x|,|y|) is in the outer half of the grid, at
+// least N/2 cells from the corner, where the curvature of both functions is
+// small compared to the size of a cell.  The grid thus covers any distance
+// with the same relative error: at most 0.2% of the distance for N=16, 0.06%
+// for N=32, and under 0.1 degree of bearing (before it is rounded to whole
+// degrees) - see "bench -c".  (The arithmetic it replaces gets the bearing
+// to within about a degree, and does not wrap around at 180 longitude.)
+
+#include <math.h>
+#include "dump5892.h"
+
+#if defined(DSTBRG_GRID)
+
+#define GRID_N     DSTBRG_GRID
+#define GRID_BITS  (__builtin_ctz(GRID_N))
+
+typedef struct gridpt {
+    uint16_t d;      // hypotenuse, in 1/256 cell
+    uint16_t b;      // degrees clockwise from north, in 1/256 degree
+} gridpt_t;
+
+static gridpt_t grid[GRID_N+1][GRID_N+1];     // [y][x]
+
+// nm per latitude binary angle, over the scale of the interpolated value,
+// by the bit-length of max(|x|,|y|) - see dstbrg_lookup()
+static float gridnm[33];
+
+#define LATBAM2NM  5.029141902923584e-6      // 360*60/2^32
+
+void dstbrg_setup()
+{
+    for (int j=0; j <= GRID_N; j++) {
+        for (int i=0; i <= GRID_N; i++) {
+            grid[j][i].d = (uint16_t) (hypot(i, j) * 256.0 + 0.5);
+            grid[j][i].b = (uint16_t) (atan2(i, j) * (180.0 / M_PI) * 256.0 + 0.5);
+        }
+    }
+    for (int n=1; n <= 32; n++)
+        gridnm[n] = (float) (LATBAM2NM * ldexp(1.0, n - (GRID_BITS + 8) - 16));
+}
+
+static inline uint32_t iabs(int32_t a)
+{
+    return (a < 0 ? -(uint32_t) a : (uint32_t) a);
+}
+
+// fo.distance and fo.bearing for the position decoded into mm
+void dstbrg_lookup(const cprref_t *ref)
+{
+    int32_t y = (int32_t) ((uint32_t) mm.latbam - (uint32_t) ref->reflatbam);
+    int32_t dlon = (int32_t) ((uint32_t) mm.lonbam - (uint32_t) ref->reflonbam);
+    int32_t x = (int32_t) (((int64_t) dlon * ref->coslat) >> 16);
+    uint32_t ax = iabs(x);
+    uint32_t ay = iabs(y);
+    uint32_t m = (ax > ay ? ax : ay);
+    if (m == 0) {
+        fo.distance = 0;
+        fo.bearing = 0;
+        return;
+    }
+
+    // scale to max(ax,ay) in [N/2, N) cells, with 8 bits of fraction
+    int n = 32 - __builtin_clz(m);
+    int s = n - (GRID_BITS + 8);
+    if (s >= 0) {
+        ax >>= s;
+        ay >>= s;
+    } else {
+        ax <<= -s;
+        ay <<= -s;
+    }
+    uint32_t u = (ax & 0xFF);
+    uint32_t v = (ay & 0xFF);
+    const gridpt_t *p = &grid[ay >> 8][ax >> 8];
+    const gridpt_t *q = p + (GRID_N+1);       // the next row up
+
+    // bilinear: the weights add up to 2^16
+    uint32_t w00 = (256-u) * (256-v);
+    uint32_t w01 = u * (256-v);
+    uint32_t w10 = (256-u) * v;
+    uint32_t w11 = u * v;
+    uint32_t d = p[0].d * w00 + p[1].d * w01 + q[0].d * w10 + q[1].d * w11;
+    uint32_t b = p[0].b * w00 + p[1].b * w01 + q[0].b * w10 + q[1].b * w11;
+    fo.distance = (float) d * gridnm[n];
+
+    // from the first quadrant to the actual one, still in 1/256 degree
+    int32_t brg = (int32_t) ((b + (1<<15)) >> 16);
+    if (y < 0)
+        brg = 180*256 - brg;
+    if (x < 0)
+        brg = 360*256 - brg;
+    brg = (brg + 128) >> 8;
+    fo.bearing = (brg >= 360 ? brg - 360 : brg);
+}
+
+#endif  // DSTBRG_GRID
@@ -22,25 +22,77 @@
 
 #define TESTING
 
+// Run the reception, parsing and traffic table upkeep in a task of its own
+// (on the other core of the ESP32, or a std::thread on the host), so that
+// slow console output and commands do not stall the input from the GNS5892.
+//#define THREADED
+
+// Look up the distance and bearing of each position in a grid of this many
+// cells per side (a power of 2, 16 to 128, taking (N+1)^2 * 4 bytes), rather
+// than work them out with the approximate hypotenuse and atan2 - see dstbrg.cpp.
+//#define DSTBRG_GRID 32
+
+// Measure the CPU cycles taken by each stage of the processing, shown by
+// the PRF command.  Without this, the PRF_START/PRF_STOP macros are empty.
+//#define PROFILING
+
+// Keep the traffic table in a compact form, with the times in 16 bits, the
+// altitude in 25-ft units, the CPR frames and the velocities packed into bit
+// fields and the callsign in 6-bit characters, for more aircraft in the same
+// RAM - see traffic.cpp.  What is shown of the traffic is the same.
+//#define COMPACT_TABLE
+
 #define ENTRY_EXPIRATION_TIME  30 /* seconds */
+#define GROUND_EXPIRATION_TIME 20 /* seconds, for traffic on the ground */
 
 #define SERIAL_IN_BR      921600
 #define SERIAL_OUT_BR     115200
 #define HIGHER_OUT_BR     230400
 
 #define INPUT_BUF_SIZE      1000
+#define INPUT_MAX_SENTENCE   100   // longest valid is 31 chars
 #define OUTPUT_BUF_SIZE     1000
 
 #define PARSE_BUF_SIZE      1000
 
-#define MAX_TRACKING_OBJECTS 32   // must be a power of 2
+#if !defined(MAX_TRACKING_OBJECTS)
+#define MAX_TRACKING_OBJECTS 32   // must be a power of 2, up to 1024
+#endif
+#if (MAX_TRACKING_OBJECTS & (MAX_TRACKING_OBJECTS-1)) || MAX_TRACKING_OBJECTS > 1024
+#error MAX_TRACKING_OBJECTS must be a power of 2, up to 1024
+#endif
+// Traffic on the ground (from surface position messages) is kept apart, in
+// this many more entries after the airborne ones, so that it does not
+// crowd out the airborne traffic - see traffic.cpp
+#if !defined(MAX_GROUND_OBJECTS)
+#define MAX_GROUND_OBJECTS 16     // must be a power of 2, up to MAX_TRACKING_OBJECTS
+#endif
+#if (MAX_GROUND_OBJECTS & (MAX_GROUND_OBJECTS-1)) || MAX_GROUND_OBJECTS > MAX_TRACKING_OBJECTS
+#error MAX_GROUND_OBJECTS must be a power of 2, up to MAX_TRACKING_OBJECTS
+#endif
+#define TRAFFIC_SLOTS (MAX_TRACKING_OBJECTS+MAX_GROUND_OBJECTS)
+
+#if defined(DSTBRG_GRID)
+#if (DSTBRG_GRID & (DSTBRG_GRID-1)) || DSTBRG_GRID < 16 || DSTBRG_GRID > 128
+#error DSTBRG_GRID must be a power of 2, 16 to 128
+#endif
+#endif
+
+#define CPR_PAIR_MS      10000   // even & odd frames this close in time decode globally
+#define CPR_LOCAL_MS     60000   // decode relative to an aircraft's own fix this recent
+#define CPR_REF_MS        1000   // rebuild the CPR reference at most this often
+#define CPR_REF_MOVE    (1<<9)   // and only when we moved 1/256 zone (~1.4 nm)
+
+#define GNSS_BR           9600   // NMEA input from an own-ship GNSS receiver
+#define GNSS_MAX_SENTENCE   82
+
+#define OUTQ_SIZE           32   // must be a power of 2
+#define OUTQ_TEXT          160
 
 typedef struct UFO {
     uint32_t  addr;
     uint32_t  positiontime;
     uint32_t  velocitytime;
-    uint32_t  updatetime;
-    uint32_t  reporttime;
     float    latitude;
     float    longitude;
     uint32_t  altitude;
@@ -62,11 +114,130 @@ typedef struct UFO {
     uint8_t   vert_rate_source;
     int16_t   vert_rate;
     int16_t   alt_diff;
+    uint16_t  sel_alt;     // feet - from Comm-B replies, see parse_comm_b()
+    int16_t   roll;        // tenths of a degree, right wing down
+    int16_t   tas;         // true airspeed, knots
+    int16_t   ias;         // indicated airspeed, knots
+    uint16_t  mach;        // thousandths
+    int16_t   mag_heading;
+    uint8_t   commb_fields;     // which of these are known, CB_SELALT etc
+    uint32_t  commbtime;
     char callsign[10];
     uint8_t   rssi;
-    uint8_t   next;
+    uint16_t  next;       // links the empty entries
+    uint8_t   cprflags;   // CPR_EVEN, CPR_ODD, CPR_FIX - see cpr.cpp
+    uint32_t  cprlat_eo[2];    // the last even [0] and odd [1] frames,
+    uint32_t  cprlon_eo[2];    //   17-bit CPR lat/lon as received
+    uint32_t  cprtime[2];      // millis() when each arrived
 } ufo_t;
 
+#define CPR_EVEN   0x01   // cprlat_eo[0] etc are filled in
+#define CPR_ODD    0x02   // cprlat_eo[1] etc are filled in
+#define CPR_FIX    0x04   // position decoded without depending on our own location
+
+#define CB_SELALT  0x01   // from BDS 4,0
+#define CB_ROLL    0x02   // from BDS 5,0
+#define CB_TAS     0x04   // from BDS 5,0
+#define CB_IAS     0x08   // from BDS 6,0
+#define CB_MACH    0x10   // from BDS 6,0
+#define CB_MAGHDG  0x20   // from BDS 6,0
+
+// The traffic table does not hold ufo_t records: the few fields that the
+// sweeps over it look at are in an array of their own, and the rest in
+// arrays each written by one kind of message - see traffic.cpp.  A whole
+// entry is copied out into a ufo_t by traffic_snapshot(), and these parts
+// are read directly by the decoding, which runs where the table is written.
+#if defined(COMPACT_TABLE)
+// The frames' times in 1/8 seconds (millis() >> 7), which wrap around in
+// 68 minutes - frames older than CPR_LOCAL_MS are forgotten long before.
+typedef struct {
+    float     latitude;        // as in ufo_t
+    float     longitude;
+    uint32_t  cprlat_e : 17, cprtime_e : 15;
+    uint32_t  cprlon_e : 17, cprtime_o : 15;
+    uint32_t  cprlat_o : 17, cprflags : 8;
+    uint32_t  cprlon_o : 17;
+} cpr_track_t;
+
+// The fields as wide as their values from the messages can be.
+typedef struct {
+    int32_t   ewv : 14;        // as in ufo_t
+    int32_t   nsv : 14;
+    uint32_t  track_is_valid : 1;
+    uint32_t  heading_is_valid : 1;
+    uint32_t  airspeed_type : 1;
+    uint32_t  vert_rate_source : 1;
+    int32_t   groundspeed : 14;
+    int32_t   alt_diff : 13;
+    uint32_t  track : 10;
+    uint32_t  heading : 10;
+    uint32_t  airspeed : 12;
+    int16_t   vert_rate;
+    uint16_t  velocitytime;    // relative to an epoch, see traffic.cpp
+} velocity_t;
+
+static inline uint32_t cpr_lat(const cpr_track_t *tp, int f)
+{
+    return (f ? tp->cprlat_o : tp->cprlat_e);
+}
+
+static inline uint32_t cpr_lon(const cpr_track_t *tp, int f)
+{
+    return (f ? tp->cprlon_o : tp->cprlon_e);
+}
+
+// milliseconds since the frame of parity f arrived, to within 1/8 second
+// - a time of zero means no such frame
+static inline uint32_t cpr_age(const cpr_track_t *tp, int f, uint32_t now)
+{
+    uint32_t t = (f ? tp->cprtime_o : tp->cprtime_e);
+    if (t == 0)
+        return 0xFFFFFFFF;
+    return (((now >> 7) - t) & 0x7FFF) << 7;
+}
+#else
+typedef struct {
+    float     latitude;        // as in ufo_t
+    float     longitude;
+    uint8_t   cprflags;
+    uint32_t  cprlat_eo[2];
+    uint32_t  cprlon_eo[2];
+    uint32_t  cprtime[2];
+} cpr_track_t;
+
+typedef struct {
+    uint32_t  velocitytime;    // as in ufo_t
+    int16_t   ewv;
+    int16_t   nsv;
+    int16_t   groundspeed;
+    int16_t   track;
+    uint8_t   track_is_valid;
+    uint8_t   heading_is_valid;
+    int16_t   heading;
+    int16_t   airspeed;
+    uint8_t   airspeed_type;
+    uint8_t   vert_rate_source;
+    int16_t   vert_rate;
+    int16_t   alt_diff;
+} velocity_t;
+
+static inline uint32_t cpr_lat(const cpr_track_t *tp, int f)
+{
+    return tp->cprlat_eo[f];
+}
+
+static inline uint32_t cpr_lon(const cpr_track_t *tp, int f)
+{
+    return tp->cprlon_eo[f];
+}
+
+// milliseconds since the frame of parity f arrived
+static inline uint32_t cpr_age(const cpr_track_t *tp, int f, uint32_t now)
+{
+    return now - tp->cprtime[f];
+}
+#endif
+
 extern const char* ac_type_label[16];
 
 extern const char *hex;
@@ -85,9 +256,6 @@ extern int bytes_per_ms;
 extern uint16_t minrange10;
 extern uint16_t maxrange10;
 
-// our position
-extern float reflat, reflon;
-
 // our clock
 extern uint32_t timenow;
 typedef struct aclock {
@@ -106,34 +274,65 @@ typedef struct mmstruct {
     int frame;     // DF
     int type;      // TC
     int sub;       // subtype
-    char msgtype;  // I, P or V
+    char msgtype;  // I, P, O or V
     int fflag;     // odd/even
     uint32_t cprlat;    // 17-bit relative representation
     uint32_t cprlon;
+    int32_t latbam;     // the decoded position, as binary angles
+    int32_t lonbam;
 } mm_t;
 extern mm_t mm, EmptyMsg;
 
-// variables precomputed for decoding of CPR lat/lon
-extern int NL[2];
-extern float dLat[2], flrlat[2], modlat[2], dLon[2], flrlon[2], modlon[2];
-extern int32_t cprMinuslat[2], cprNL0lat[2], cprNL1lat[2], cprPluslat[2];
-extern uint32_t ourcprlat[2], ourcprlon[2];
-extern float dLatHalf, dLonHalf;
+// variables precomputed for decoding of CPR lat/lon, from our position
+// - [2] are even and odd, see CPRRelative_precomp()
+typedef struct cprref {
+    float    reflat, reflon;           // our position
+    int32_t  reflatbam, reflonbam;     // as binary angles, see cpr.cpp
+#if defined(DSTBRG_GRID)
+    int32_t  coslat;                   // cos(reflat) * 2^16, see dstbrg.cpp
+#endif
+    int      NL[2];
+    int32_t  reflatz[2], reflonz[2];   // in units of 2^-17 CPR zone
+    uint32_t ourcprlat[2], ourcprlon[2];
+    int32_t  cprMinuslat[2], cprNL0lat[2], cprNL1lat[2], cprPluslat[2];
+    int32_t  reflonzPlus[2], reflonzMinus[2];
+    uint32_t ourcprlonPlus[2], ourcprlonMinus[2];
+} cprref_t;
+// The one in use, replaced as a whole when our position changes, while the
+// receive task may be decoding - so read the pointer once per message
+extern cprref_t *cprref;
+extern cprref_t cprrefs[2];
+static inline const cprref_t *cpr_reference()
+{
+    return __atomic_load_n(&cprref, __ATOMIC_ACQUIRE);
+}
 extern int32_t maxcprdiff, maxcprdiff_sq;
-extern float dLonPlus[2], flrlonPlus[2], modlonPlus[2];
-extern float dLonMinus[2], flrlonMinus[2], modlonMinus[2];
-extern uint32_t ourcprlonPlus[2], ourcprlonMinus[2];
 
-// the structures holding aircraft data
-extern ufo_t container[MAX_TRACKING_OBJECTS];
+// the structures holding aircraft data (the traffic table is in traffic.cpp)
 extern ufo_t fo;
 extern ufo_t EmptyFO;
 extern int num_tracked;
+extern int num_ground;
+
+#if defined(THREADED)
+// the records passed from the receive task to the output task
+#define OUTREC_TEXT     1    // to be written out as is
+#define OUTREC_DECODED  2    // to be formatted by output_decoded()
+typedef struct outrec {
+    uint8_t   kind;
+    uint8_t   frame;         // DF
+    char      msgtype;
+    uint8_t   len;           // of text[]
+    ufo_t     fo;
+    char      text[OUTQ_TEXT];
+} outrec_t;
+#endif
 
 // stored statistics
 extern int msg_by_rssi[25];
-extern int msg_by_crc_cat[2];
+extern int msg_by_crc_cat[4];
 extern int msg_by_cpr_effort[4];
+extern int msg_by_cpr_method[4];
 extern int msg_by_DF[23];
 extern int msg_by_type[26];
 extern int gray_count[4];
@@ -144,7 +343,74 @@ extern int new_by_aircraft_type[16];
 extern int msg_by_hour[24];
 extern int ticks_by_numtracked[MAX_TRACKING_OBJECTS+1];
 extern int in_discards;
+extern int in_malformed;
+extern int in_partial;
+extern int in_overlong;
+extern uint32_t batch_count;
+extern uint32_t batch_sentences;
+extern uint32_t batch_timeouts;
+extern uint32_t batch_us;
+extern uint16_t batch_max_sentences;
+extern uint32_t batch_max_us;
 extern int out_discards;
+extern int gnss_fixes;         // own-ship positions received
+extern int gnss_rejects;       // NMEA sentences with a bad checksum or no fix
+extern int cpr_rebuilds;       // CPR reference rebuilt for a new position
+extern int msg_airborne;       // airborne position messages (TC 9-18, 20-22)
+extern int msg_surface;        // surface position messages (TC 5-8)
+extern int pos_prefiltered;    // of the airborne, rejected as too far from the hex
+extern int negcache_hits;      // positions dropped, aircraft recently rejected
+extern int negcache_misses;    // positions not from recently rejected aircraft
+extern int negcache_expired;   // rejected aircraft given another chance
+extern int ground_full;        // new ground traffic ignored, no room
+extern int ground_expired;     // ground traffic entries expired
+extern int ground_moves[2];    // entries moved: [0] landed, [1] took off
+// why an airborne entry was given up for a new aircraft while the table was
+//   full, or the new aircraft was not let in - the term of the score that
+//   made the most difference, see traffic.cpp
+enum { EVICT_QUIET, EVICT_DIST, EVICT_ALT, EVICT_RATE, EVICT_AGE, EVICT_TYPE, EVICT_REASONS };
+extern int evicted_by_reason[EVICT_REASONS];
+extern int rejected_by_reason[EVICT_REASONS];
+extern int commb_addr[2];      // DF20/21 with the AP address [0] in the table, [1] not
+extern int msg_by_bds[4];      // Comm-B inferred as BDS [0] 4,0 [1] 5,0 [2] 6,0, [3] none
+#if defined(THREADED)
+extern int outq_full;
+extern int outq_maxdepth;
+#endif
+#if defined(PROFILING)
+// cycles spent per call in each stage, as a histogram with log2 buckets
+enum {
+    PRF_INPUT,      // input_loop()
+    PRF_PARSE,      // parse() - includes PRF_CPR
+    PRF_CPR,        // decodeCPR()
+    PRF_TRAFFIC,    // traffic_loop()
+    PRF_OUTPUT,     // output_loop()
+    PRF_CMD,        // cmd_loop()
+    PRF_STAGES
+};
+typedef struct prf_stage {
+    uint32_t count;
+    uint32_t max;
+    uint64_t total;
+    uint32_t hist[32];      // [k] counts calls taking 2^k to 2^(k+1)-1 cycles
+} prf_stage_t;
+extern prf_stage_t prf_stages[PRF_STAGES];
+
+static inline void prf_record(int stage, uint32_t cycles)
+{
+    prf_stage_t *p = &prf_stages[stage];
+    ++p->count;
+    p->total += cycles;
+    if (cycles > p->max)
+        p->max = cycles;
+    ++p->hist[cycles ? 31 - __builtin_clz(cycles) : 0];
+}
+#define PRF_START(t)         uint32_t t = ESP.getCycleCount()
+#define PRF_STOP(stage, t)   prf_record(stage, ESP.getCycleCount() - t)
+#else
+#define PRF_START(t)
+#define PRF_STOP(stage, t)
+#endif
 #if defined(TESTING)
 extern int upd_by_gs_incorrect[2];
 extern int upd_by_trk_incorrect[2];
@@ -158,21 +424,59 @@ void play5892();
 void show_settings();
 void interpret_cmd(char *sentence, int len);
 bool parse(char *buf, int n);
+void negcache_clear();
 int find_traffic_by_addr(uint32_t addr);
 int find_closest_traffic();
+void traffic_rerank();
 void update_traffic_identity();
 void update_traffic_position();
+void update_traffic_surface();
 void update_traffic_velocity();
 void update_mode_s_traffic();
-void traffic_update(int i);
+void update_comm_b_traffic();
+void traffic_snapshot(int k, ufo_t *fop);
+uint32_t traffic_addr(int k);
+uint32_t traffic_positiontime(int k);
+const cpr_track_t *traffic_cpr(int k);
+const velocity_t *traffic_velocity(int k);
 void traffic_setup();
+void traffic_memory_report();
+void input_setup();
 void traffic_loop();
-int decodeCPRrelative();
+int decodeCPR(const cprref_t *ref);
+int cprNLFunction(int32_t lat);
+int decodeCPRrelative(const cprref_t *ref);
+int decodeCPRsurface(const cprref_t *ref);
+int decodeCPRbatch(const cprref_t *ref, int n, const uint32_t *cprlat,
+                   const uint32_t *cprlon, const uint8_t *fflag,
+                   int32_t *lat, int32_t *lon, int8_t *status);
 void CPRRelative_precomp();
+bool CPRRelative_update(float lat, float lon);
 void CPRRelative_setup();
+#if defined(DSTBRG_GRID)
+void dstbrg_setup();
+void dstbrg_lookup(const cprref_t *ref);
+#endif
+void gnss_setup();
+void gnss_loop();
+bool gnss_sentence(char *s);
 uint32_t check_crc( int n );
+void crc_fix_setup(int depth);
+int fix_crc(uint32_t syndrome);
+#if defined(TESTING)
+uint32_t mode_s_checksum_bitwise( int n );
+#endif
 void EEPROM_setup();
 void EEPROM_store();
 char *time_string(bool withdate);
+#if defined(THREADED)
+void threads_setup();
+bool rx_loop();
+void rx_hold(bool hold);
+bool outq_text(const char *p, int n);
+bool outq_decoded(ufo_t *f, mm_t *m);
+outrec_t *outq_peek();
+void outq_release();
+#endif
 
 #endif  // DUMP5892_H
@@ -43,9 +43,13 @@ void setup()
   }
 
   traffic_setup();
+  traffic_memory_report();
+  input_setup();
+
+  crc_fix_setup(settings->fixbits);
 
   CPRRelative_setup();
-  if (reflat == 0 || reflon == 0)
+  if (cprref->reflat == 0 || cprref->reflon == 0)
       Serial.println("\n>>>> Reference lat/lon not set, positions will be wrong!\n");
 
   if (settings->rx_pin > 39) {
@@ -57,12 +61,17 @@ void setup()
       Serial2.begin(SERIAL_IN_BR, SERIAL_8N1, settings->rx_pin, settings->tx_pin);
       has_serial2 = true;
   }
+  gnss_setup();
 
   timenow = 100;
   delay(1000);
   pause5892();
   show_settings();
   reset5892();
+
+#if defined(THREADED)
+  threads_setup();
+#endif
 }
 
 char *time_string(bool withdate)
@@ -124,12 +133,29 @@ static bool output_maybe(char *p, int n)
     return true;
 }
 
+#if defined(THREADED)
+static char outline[PARSE_BUF_SIZE];    // parsed[] belongs to the receive task
+#else
+#define outline parsed
+#endif
+
+// output of text based on a single message, which in the THREADED mode is
+//   produced by the receive task and written out later by the output task
+static bool output_text(char *p, int n)
+{
+#if defined(THREADED)
+    return outq_text(p, n);
+#else
+    return output_maybe(p, n);
+#endif
+}
+
 void output_raw()
 {
     buf[inputchars++] = ';';
     buf[inputchars++] = '\r';
     buf[inputchars++] = '\n';
-    output_maybe(buf, inputchars);
+    output_text(buf, inputchars);
     inputchars = 0;      // start a new input sentence
 }
 
@@ -160,12 +186,12 @@ subtype
                     airspeed
                     heading
 */
-void output_decoded()
+void output_decoded(ufo_t *fop, int frame, char msgtype)
 {
     //if (mm.frame != 17 && mm.frame != 18)
     //    return;
     // construct a single line of text about the last arrived message
-    const char *cs = ((fo.callsign[0] != '\0' || settings->format!=TXTFMT)? fo.callsign : "        ");
+    const char *cs = ((fop->callsign[0] != '\0' || settings->format!=TXTFMT)? fop->callsign : "        ");
     const char *fmt;
     if (settings->dstbrg) {
       if (settings->format==TABFMT)
@@ -175,12 +201,12 @@ void output_decoded()
       else // TXTFMT
         fmt = "%s %02d %02d %c %06X %s %02d %5.1f %03d %5d %5d %5d %4d %4d %3d %3d\r\n";
             //tm rssi DF msgtyp ID cs actyp dst brg altitud altdif vs nsv ewv aspd hdg
-      snprintf(parsed, PARSE_BUF_SIZE, fmt,
+      snprintf(outline, PARSE_BUF_SIZE, fmt,
         time_string(true),
-        fo.rssi, mm.frame, mm.msgtype, fo.addr, cs, fo.aircraft_type,
-        fo.distance, fo.bearing,
-        fo.altitude, fo.alt_diff, fo.vert_rate,
-        fo.nsv, fo.ewv, fo.airspeed, fo.heading);
+        fop->rssi, frame, msgtype, fop->addr, cs, fop->aircraft_type,
+        fop->distance, fop->bearing,
+        fop->altitude, fop->alt_diff, fop->vert_rate,
+        fop->nsv, fop->ewv, fop->airspeed, fop->heading);
     } else {
       if (settings->format==TABFMT)
         fmt = "%s\t%d\t%d\t%c\t%06X\t%s\t%d\t%.4f\t%.4f\t%d\t%d\t%d\t%d\t%d\t%d\t%d\r\n";
@@ -189,14 +215,46 @@ void output_decoded()
       else // TXTFMT
         fmt = "%s %02d %02d %c %06X %s %02d %9.4f %9.4f %5d %5d %5d %4d %4d %3d %3d\r\n";
              //tm rssi DF msgtyp ID cs actyp lat lon altitud altdif vs nsv ewv aspd hdg
-      snprintf(parsed, PARSE_BUF_SIZE, fmt,
+      snprintf(outline, PARSE_BUF_SIZE, fmt,
         time_string(true),
-        fo.rssi, mm.frame, mm.msgtype, fo.addr, cs, fo.aircraft_type,
-        fo.latitude, fo.longitude, fo.altitude, fo.alt_diff, fo.vert_rate,
-        fo.nsv, fo.ewv, fo.airspeed, fo.heading);
+        fop->rssi, frame, msgtype, fop->addr, cs, fop->aircraft_type,
+        fop->latitude, fop->longitude, fop->altitude, fop->alt_diff, fop->vert_rate,
+        fop->nsv, fop->ewv, fop->airspeed, fop->heading);
+    }
+    output_maybe(outline, strlen(outline));
+}
+
+// When each entry of the traffic table was last shown, and to which
+// aircraft - kept here, by the output side, since the receive task may
+// give the entry to another aircraft at any time.
+static uint32_t report_time[TRAFFIC_SLOTS];
+static uint32_t report_addr[TRAFFIC_SLOTS];
+
+static uint32_t reporttime(int k, uint32_t addr)
+{
+    return (report_addr[k] == addr ? report_time[k] : 0);
+}
+
+static void set_reporttime(int k, uint32_t addr, uint32_t t)
+{
+    report_addr[k] = addr;
+    report_time[k] = t;
+}
+
+// the entry of this aircraft, *base-0*, or -1 - found by the IDs alone, not
+//   by the index that the receive task may be rearranging meanwhile
+static int find_slot(uint32_t addr)
+{
+    static int last = 0;
+    if (traffic_addr(last) == addr)
+        return last;
+    for (int k=0; k < TRAFFIC_SLOTS; k++) {
+        if (traffic_addr(k) == addr) {
+            last = k;
+            return k;
+        }
     }
-    parsedchars = strlen(parsed);
-    output_maybe(parsed, parsedchars);
+    return -1;
 }
 
 void output_page()
@@ -204,10 +262,9 @@ void output_page()
     // only output a page if there is new data from the followed aircraft
     int i;
     if (settings->follow != 0) {
-        i = find_traffic_by_addr(settings->follow);
-        if (i == 0)
+        i = find_slot(settings->follow);
+        if (i < 0)
             return;
-        --i;      // from base-1 to base-0 indexing
     } else {
         // if page format is selected and no aircraft is "followed"
         //   then show the closest aircraft, or else any one aircraft
@@ -215,26 +272,30 @@ void output_page()
         if (i > 0) {
             --i;      // from base-1 to base-0 indexing
         } else {
-            for (i=0; i < MAX_TRACKING_OBJECTS; i++) {
-               if (container[i].addr)
+            for (i=0; i < TRAFFIC_SLOTS; i++) {
+               if (traffic_addr(i))
                    break;
             }
-            if (i == MAX_TRACKING_OBJECTS)           // no tracked aircraft
+            if (i == TRAFFIC_SLOTS)                  // no tracked aircraft
                 return;
         }
     }
-    //traffic_update(i);
-    ufo_t *fop = &container[i];
-    if (fop->reporttime >= fop->positiontime)        // nothing new to report
+    ufo_t f;
+    ufo_t *fop = &f;
+    traffic_snapshot(i, fop);     // a consistent copy, may have changed since found
+    if (fop->addr == 0 || (settings->follow != 0 && fop->addr != settings->follow))
+        return;
+    uint32_t reported = reporttime(i, fop->addr);
+    if (reported >= fop->positiontime)              // nothing new to report
         return;
-    if (timenow < fop->reporttime + 3)              // don't report too often
+    if (timenow < reported + 3)                     // don't report too often
         return;
-    fop->reporttime = timenow;
+    set_reporttime(i, fop->addr, timenow);
     Serial.println("\n----------------------------------------\n");
     // construct a page of text about the followed aircraft
     uint32_t timesince = timenow - fop->positiontime;
-    const char *cs = ((fo.callsign[0] != '\0')? fo.callsign : "        ");
-    snprintf(parsed, PARSE_BUF_SIZE,
+    const char *cs = ((fop->callsign[0] != '\0')? fop->callsign : "        ");
+    snprintf(outline, PARSE_BUF_SIZE,
 "\
 %s      %d seconds since last position report    RSSI=%02d\n\
 ICAO ID: %06X   Callsign: %s    Aircraft Type: %s\n\
@@ -252,8 +313,16 @@ Airspeed    = %4d knots   Heading = %3d\n",
         fop->alt_diff, fop->vert_rate,
         fop->groundspeed, fop->track,
         fop->airspeed, fop->heading);
-    parsedchars = strlen(parsed);
-    Serial.write(parsed, parsedchars);  // may block, but this happens only every 3 seconds or so
+    Serial.write(outline, strlen(outline));  // may block, but this happens only every 3 seconds or so
+    if (fop->commb_fields) {
+        snprintf(outline, PARSE_BUF_SIZE,
+"\
+Comm-B (%d seconds ago): Selected altitude = %5d   Roll = %5.1f\n\
+     TAS = %3d knots   IAS = %3d knots   Mach = %.3f   Magnetic heading = %3d\n",
+            timenow - fop->commbtime, fop->sel_alt, fop->roll * 0.1,
+            fop->tas, fop->ias, fop->mach * 0.001, fop->mag_heading);
+        Serial.write(outline, strlen(outline));
+    }
 }
 
 // list active entries in traffic table (those with recent position data)
@@ -266,7 +335,7 @@ void output_list()
       if (millis() < nexttime)
           return;
       nexttime = millis() + 4000;
-      if (num_tracked == 0)
+      if (num_tracked == 0 && num_ground == 0)
           return;                // try again in another 4 seconds
       active = true;
       tick = 0;
@@ -275,23 +344,30 @@ void output_list()
   } else {
       // active, report one aircraft per loop() iteration (no millis() wait)
       tick++;
-      if (tick >= MAX_TRACKING_OBJECTS) {
+      if (tick >= TRAFFIC_SLOTS) {
           active = false;
           return;
       }
   }
-  ufo_t *fop = &container[tick];
+  // most entries are passed over by the hot fields alone, without a snapshot
+  uint32_t addr = traffic_addr(tick);
+  if (addr == 0 || timenow > traffic_positiontime(tick) + 3
+        || timenow < reporttime(tick, addr) + 2)
+      return;
+  ufo_t f;
+  ufo_t *fop = &f;
+  traffic_snapshot(tick, fop);
   if (fop->addr == 0)
       return;
   if (timenow > fop->positiontime + 3)     // not heard from recently
       return;
-  if (timenow < fop->reporttime + 2)       // reported recently
+  if (timenow < reporttime(tick, fop->addr) + 2)     // reported recently
       return;
-  fop->reporttime = timenow;
+  set_reporttime(tick, fop->addr, timenow);
   // construct a single line of text about each tracked aircraft
   const char *fmt;
   const char *t = time_string(true);      // a bit later than actual position time
-  const char *cs = ((fo.callsign[0] != '\0' || settings->format!=TXTFMT)? fo.callsign : "        ");
+  const char *cs = ((fop->callsign[0] != '\0' || settings->format!=TXTFMT)? fop->callsign : "        ");
   const char *g = (fop->alt_type? "g" : settings->format==TXTFMT? " " : "");
   if (settings->dstbrg) {
     if (settings->format==TABFMT)
@@ -301,7 +377,7 @@ void output_list()
     else // TXTFMT
       fmt = "[%2d] %s %02d %06X %s %02d %5.1f %03d %s %5d %5d %5d %3d %3d %3d %3d\r\n";
            //idx time rssi ID cs actyp dst brg altitude altdif vs gspd trk aspd hdg
-    snprintf(parsed, PARSE_BUF_SIZE, fmt,
+    snprintf(outline, PARSE_BUF_SIZE, fmt,
       tick, t, fop->rssi, fop->addr, cs, fop->aircraft_type,
       fop->distance, fop->bearing,
       g, fop->altitude, fop->alt_diff, fop->vert_rate,
@@ -315,23 +391,89 @@ void output_list()
     else // TXTFMT
       fmt = "[%2d] %s %02d %06X %s %02d %9.4f %9.4f %s %5d %5d %5d %3d %3d %3d %3d\r\n";
             //idx time rssi ID cs actyp lat lon altitud altdif vs gspd trk aspd hdg
-    snprintf(parsed, PARSE_BUF_SIZE, fmt,
+    snprintf(outline, PARSE_BUF_SIZE, fmt,
       tick, t, fop->rssi, fop->addr, cs, fop->aircraft_type,
       fop->latitude, fop->longitude,
       g, fop->altitude, fop->alt_diff, fop->vert_rate,
       fop->groundspeed, fop->track,
       fop->airspeed, fop->heading);
   }
-  parsedchars = strlen(parsed);
-  if (output_maybe(parsed, parsedchars) == false) {
+  if (output_maybe(outline, strlen(outline)) == false) {
       // try the same one again next time around the loop():
-      fop->reporttime -= 2;
+      set_reporttime(tick, fop->addr, timenow - 2);
       --tick;
   }
 }
 
 static bool input_complete;
 
+// Input from the GNS5892 is read in bulk into this staging buffer, with one
+// readBytes() call for whatever the UART driver has buffered, and then framed
+// into sentences from here.  A sentence still in progress when the data runs
+// out is moved to the start of the buffer, so that it is always contiguous.
+static char inbuf[INPUT_BUF_SIZE];
+static int inhead = 0;        // next char to be scanned
+static int intail = 0;        // end of the data in inbuf[]
+static int instart = -1;      // start of the sentence in progress, -1 if none
+
+// chars that start or end a sentence, all other chars are 0
+#define DELIM_START 1
+#define DELIM_END   2
+static uint8_t delim[256];
+
+void input_setup()
+{
+    delim['*'] = DELIM_START;
+    delim['+'] = DELIM_START;
+    delim['#'] = DELIM_START;
+    delim[';']  = DELIM_END;
+    delim['\r'] = DELIM_END;
+    delim['\n'] = DELIM_END;
+}
+
+// frame the next complete sentence in inbuf[] into buf[], if there is one
+static bool input_next()
+{
+    char *e = &inbuf[intail];
+    for (;;) {
+        char *p = &inbuf[inhead];
+        while (p < e && delim[(uint8_t) *p] == 0)   // skip to next delimiter
+            p++;
+        if (p == e) {
+            inhead = intail;
+            if (instart >= 0 && intail - instart > INPUT_MAX_SENTENCE) {
+                ++in_overlong;
+                instart = -1;
+            }
+            return false;
+        }
+        int i = p - inbuf;
+        inhead = i + 1;
+        if (delim[(uint8_t) *p] == DELIM_START) {
+            if (instart >= 0)
+                ++in_partial;        // previous sentence was cut off
+            instart = i;             // start new sentence, drop any preceding data
+            continue;
+        }
+        if (instart < 0)             // e.g., the CR-LF after the ';'
+            continue;
+        int n = i - instart;         // includes the starting char
+        int s = instart;
+        instart = -1;
+        if (n > INPUT_MAX_SENTENCE) {
+            ++in_overlong;
+            continue;
+        }
+        if (n <= 14) {               // invalid, start over
+            ++in_partial;
+            continue;
+        }
+        memcpy(buf, &inbuf[s], n);
+        inputchars = n;
+        return true;
+    }
+}
+
 void input_loop()
 {
     if (input_complete)
@@ -339,32 +481,38 @@ void input_loop()
     input_complete = false;
     if (has_serial2 == false)
         return;
-    int n = inputchars;
-    if (n == 0) {                // waiting for a new sentence to start
-        if (Serial2.available() > (INPUT_BUF_SIZE - 256)) {
-            // input buffer is getting full, drain it
-            Serial2.readBytes(buf, 256);  // discard some input data
-            in_discard();
-        }
+    if (input_next()) {          // more sentences left from the last read
+        input_complete = true;
+        return;
     }
-    while (Serial2.available()) {  // loop until a full sentence or no more data
-        char c = Serial2.read();
-        if (c=='*' || c=='+' || c=='#') {
-            buf[0] = c;            // start new sentence, drop any preceding data
-            n = 1;
-        } else if (n == 0) {      // wait for a valid starting char
-            continue;
-        } else if (c==';' || c=='\r' || c=='\n') {   // completed sentence
-            if (n > 14 /* && n <= 32 */ ) {
-                input_complete = true;
-                break;
-            }
-            n = 0;                 // invalid, start over
-        } else {
-            buf[n++] = c;
+    // keep only the partial sentence, if any, at the start of the buffer
+    if (instart > 0) {
+        intail -= instart;
+        memmove(inbuf, &inbuf[instart], intail);
+        inhead = intail;
+        instart = 0;
+    } else if (instart < 0) {
+        inhead = intail = 0;
+    }
+    int n = Serial2.available();
+    if (n > (INPUT_BUF_SIZE - 256)) {
+        // input buffer is getting full, drain it
+        Serial2.readBytes(buf, 256);  // discard some input data
+        in_discard();
+        if (instart >= 0) {
+            ++in_partial;
+            inhead = intail = 0;
+            instart = -1;
         }
+        n -= 256;
     }
-    inputchars = n;
+    if (n > INPUT_BUF_SIZE - intail)
+        n = INPUT_BUF_SIZE - intail;
+    if (n <= 0)
+        return;
+    intail += Serial2.readBytes(&inbuf[intail], n);
+    if (input_next())
+        input_complete = true;
 }
 
 void parse_loop()
@@ -376,31 +524,27 @@ void parse_loop()
 
     if (inputchars > 0 && settings->parsed != RAWFMT) {
         if (buf[0] == '*' || buf[0] == '+') {        // ADS-B data received
+            PRF_START(t);
             parsing_success = parse(buf, inputchars);
+            PRF_STOP(PRF_PARSE, t);
         } else if (buf[0] == '#') {                  // response to commands
+#if defined(THREADED)
+            buf[inputchars] = '\r';
+            buf[inputchars+1] = '\n';
+            outq_text(buf, inputchars+2);
+#else
             Serial.write(buf, inputchars);           // copy to console
             Serial.println("");
+#endif
         }
     }
 }
 
-void output_loop()
+// output formats based on the most recent message
+static void output_message()
 {
-    if (settings->parsed == NOTHING)
+    if (settings->parsed == NOTHING || settings->parsed >= LSTFMT)
         return;
-    // output formats based on the traffic table:
-    if (settings->parsed == LSTFMT) {
-        output_list();
-        return;
-    }
-    if (settings->parsed == PAGEFMT) {
-        if (settings->follow != 0 || num_tracked == 1 || find_closest_traffic() > 0)
-            output_page();
-        else
-            output_list();
-        return;
-    }
-    // output formats based on the most recent message:
     if (! input_complete)
         return;
     if (inputchars == 0)
@@ -417,19 +561,79 @@ void output_loop()
         int i = find_traffic_by_addr(fo.addr);
         if (i == 0)                              // not in traffic table
             return;                              // have not received a position message yet
-        if (container[i-1].positiontime == 0)    // no identity message, or filtered out 
+        if (traffic_positiontime(i-1) == 0)     // no identity message, or filtered out 
             return;
         output_raw();
         return;
     }
     inputchars = 0;
     if (settings->parsed == FLDFMT) {
-        output_maybe(parsed, parsedchars);
+        output_text(parsed, parsedchars);
         return;
     }
-    output_decoded();
+#if defined(THREADED)
+    outq_decoded(&fo, &mm);
+#else
+    output_decoded(&fo, mm.frame, mm.msgtype);
+#endif
 }
 
+#if defined(THREADED)
+// write out what the receive task has queued up
+static void output_queued()
+{
+    outrec_t *r;
+    while ((r = outq_peek()) != NULL) {
+        if (r->kind == OUTREC_DECODED)
+            output_decoded(&r->fo, r->frame, r->msgtype);
+        else
+            output_maybe(r->text, r->len);
+        outq_release();
+    }
+}
+#endif
+
+void output_loop()
+{
+#if defined(THREADED)
+    output_queued();
+#endif
+    if (settings->parsed == NOTHING)
+        return;
+    // output formats based on the traffic table:
+    if (settings->parsed == LSTFMT) {
+        output_list();
+        return;
+    }
+    if (settings->parsed == PAGEFMT) {
+        if (settings->follow != 0 || num_tracked == 1 || find_closest_traffic() > 0)
+            output_page();
+        else
+            output_list();
+        return;
+    }
+#if !defined(THREADED)
+    output_message();    // (in the THREADED mode done by the receive task)
+#endif
+}
+
+#if defined(THREADED)
+static bool cmd_readonly(const char *s)
+{
+    static const char *readonly[] = { "TBL", "STA", "SET", "HLP", "COD" };
+    if (strlen(s) < 3)
+        return false;
+    for (int i=0; i < 5; i++) {
+        if (strncasecmp(s, readonly[i], 3) == 0)
+            return true;
+    }
+    return false;
+}
+#else
+#define cmd_readonly(s)  true
+#define rx_hold(b)
+#endif
+
 void cmd_loop()
 {
     bool complete = false;
@@ -453,15 +657,29 @@ void cmd_loop()
         cmdbuf[end_of_cmd] = '\0';
         if (cmdbuf[0] == '*' || cmdbuf[0] == '+') {   // simulated ADS-B data
             if (end_of_cmd > 3) {
+                rx_hold(true);
                 strcpy(buf, cmdbuf);
                 inputchars = end_of_cmd;
                 input_complete = true;
                 parse_loop();
                 traffic_loop();
+#if defined(THREADED)
+                output_message();
+                rx_hold(false);
+#endif
                 output_loop();
             }
+        } else if (cmdbuf[0] == '$') {               // NMEA from a GNSS receiver
+            gnss_sentence(cmdbuf);
         } else {
+            // the receive task must not run while settings or the traffic
+            // table are being changed, but it can while they are shown
+            bool hold = (cmd_readonly(cmdbuf) == false);
+            if (hold)
+                rx_hold(true);
             interpret_cmd(cmdbuf, end_of_cmd);
+            if (hold)
+                rx_hold(false);
         }
         cmdchars = 0;
     }
@@ -492,17 +710,104 @@ void clock_loop()
     }
 }
 
+// Process a batch of input sentences in one loop() pass, up to settings->batch
+// sentences or settings->batchms milliseconds, whichever comes first.
+// The output formats based on each message need to be done per sentence,
+// while those based on the traffic table are left for output_loop() later.
+int batch_loop()
+{
+    uint32_t start_us = micros();
+    uint32_t elapsed = 0;
+    uint32_t limit = 1000 * (uint32_t) settings->batchms;
+    int n = 0;
+    while (n < settings->batch) {
+        PRF_START(t);
+        input_loop();
+        PRF_STOP(PRF_INPUT, t);
+        if (! input_complete)
+            break;
+        parse_loop();
+        output_message();
+        ++n;
+        elapsed = micros() - start_us;
+        if (elapsed >= limit) {
+            if (n < settings->batch)
+                ++batch_timeouts;
+            break;
+        }
+    }
+    input_complete = false;       // any output was already done
+    if (n == 0)
+        return 0;
+    ++batch_count;
+    batch_sentences += n;
+    batch_us += elapsed;
+    if (n > batch_max_sentences)
+        batch_max_sentences = n;
+    if (elapsed > batch_max_us)
+        batch_max_us = elapsed;
+    return n;
+}
+
+#if defined(THREADED)
+// one pass of the receive task, returns false if there was no input
+bool rx_loop()
+{
+  bool busy;
+  if (settings->batch > 1) {
+    busy = (batch_loop() > 0);
+  } else {
+    PRF_START(t);
+    input_loop();
+    PRF_STOP(PRF_INPUT, t);
+    busy = input_complete;
+    parse_loop();
+    output_message();
+  }
+  PRF_START(t);
+  traffic_loop();
+  PRF_STOP(PRF_TRAFFIC, t);
+  clock_loop();
+  return busy;
+}
+
 void loop()
 {
-  input_loop();
-  yield();
-  parse_loop();
+  PRF_START(t1);
+  output_loop();
+  PRF_STOP(PRF_OUTPUT, t1);
+  PRF_START(t2);
+  cmd_loop();
+  PRF_STOP(PRF_CMD, t2);
+  gnss_loop();
+  delay(1);
+}
+#else
+void loop()
+{
+  if (settings->batch > 1) {
+    batch_loop();
+  } else {
+    PRF_START(t);
+    input_loop();
+    PRF_STOP(PRF_INPUT, t);
+    yield();
+    parse_loop();
+  }
   yield();
+  PRF_START(t1);
   traffic_loop();
+  PRF_STOP(PRF_TRAFFIC, t1);
   yield();
+  PRF_START(t2);
   output_loop();
+  PRF_STOP(PRF_OUTPUT, t2);
   yield();
+  PRF_START(t3);
   cmd_loop();
+  PRF_STOP(PRF_CMD, t3);
+  gnss_loop();
   clock_loop();
   yield();
 }
+#endif
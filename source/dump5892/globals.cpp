@@ -25,9 +25,6 @@ uint8_t cmdchars = 0;
 uint16_t minrange10 = 0;
 uint16_t maxrange10 = 1800;   // tenths of nm (setting is in whole nm)
 
-// our position
-float reflat, reflon;
-
 // our clock
 uint32_t timenow;  // seconds
 ourclock_t ourclock;
@@ -36,23 +33,16 @@ ourclock_t ourclock;
 mm_t mm, EmptyMsg;
 
 // variables precomputed for decoding of CPR lat/lon, based on our own location
-int NL[2];
-float dLat[2], flrlat[2], modlat[2], dLon[2], flrlon[2], modlon[2];
-uint32_t ourcprlat[2], ourcprlon[2];
-float dLatHalf, dLonHalf;
+// - two of them, one in use and one to build the next in, see cpr.cpp
+cprref_t cprrefs[2];
+cprref_t *cprref = &cprrefs[0];
 int32_t maxcprdiff, maxcprdiff_sq;
 
-// similar values precomputed for adjacent NL zones
-int32_t cprMinuslat[2], cprNL0lat[2], cprNL1lat[2], cprPluslat[2];
-float dLonPlus[2], flrlonPlus[2], modlonPlus[2];
-float dLonMinus[2], flrlonMinus[2], modlonMinus[2];
-uint32_t ourcprlonPlus[2], ourcprlonMinus[2];
-
 // the structures holding aircraft data
-ufo_t container[MAX_TRACKING_OBJECTS];
 ufo_t EmptyFO = {0};
 ufo_t fo;
 int num_tracked = 0;
+int num_ground = 0;
 
 const char* ac_type_label[16] PROGMEM = {
     "unknown",
@@ -75,8 +65,9 @@ const char* ac_type_label[16] PROGMEM = {
 
 // stored statistics
 int msg_by_rssi[25];
-int msg_by_crc_cat[2];
+int msg_by_crc_cat[4];   // OK, error, fixed 1 bit, fixed 2 bits
 int msg_by_cpr_effort[4];
+int msg_by_cpr_method[4];  // relative to us, to own fix, global, global failed
 int msg_by_DF[23];
 int msg_by_type[26];
 int gray_count[4] = {0,0,0,0};
@@ -87,7 +78,39 @@ int new_by_aircraft_type[16];
 int msg_by_hour[24];
 int ticks_by_numtracked[MAX_TRACKING_OBJECTS+1];
 int in_discards;
+int in_malformed;
+int in_partial;
+int in_overlong;
+uint32_t batch_count;           // batches with at least one sentence
+uint32_t batch_sentences;       // sentences processed in batches
+uint32_t batch_timeouts;        // batches cut short by the time limit
+uint32_t batch_us;              // total time spent in batches
+uint16_t batch_max_sentences;
+uint32_t batch_max_us;
 int out_discards;
+int gnss_fixes;
+int gnss_rejects;
+int cpr_rebuilds;
+int msg_airborne;
+int msg_surface;
+int pos_prefiltered;
+int negcache_hits;
+int negcache_misses;
+int negcache_expired;
+int ground_full;
+int ground_expired;
+int ground_moves[2];    // landed, took off
+int evicted_by_reason[EVICT_REASONS];
+int rejected_by_reason[EVICT_REASONS];
+int commb_addr[2];      // known, unknown
+int msg_by_bds[4];      // 4,0  5,0  6,0  none
+#if defined(THREADED)
+int outq_full;          // records dropped because the output queue was full
+int outq_maxdepth;
+#endif
+#if defined(PROFILING)
+prf_stage_t prf_stages[PRF_STAGES];
+#endif
 #if defined(TESTING)
 int upd_by_gs_incorrect[2];
 int upd_by_trk_incorrect[2];
@@ -0,0 +1,131 @@
+/*
+ * gnss.cpp - own-ship position from a GNSS receiver
+ * Copyright (C) 2024 Moshe Braner
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version - see <http://www.gnu.org/licenses/>.
+ */
+
+// When dump5892 is on the move the location that CPR positions are decoded
+// relative to (and distances measured from) is taken from the GGA or RMC
+// sentences of an NMEA feed, from any talker ($GPGGA, $GNRMC, etc).  They
+// may come from a GNSS receiver wired to Serial1 (settings->gnss_pin), or
+// be typed or piped into the console along with the commands.
+// This all runs in the loop() task, while (in the THREADED mode) the receive
+// task goes on decoding - see CPRRelative_update() for how that is safe.
+
+#include <stdlib.h>
+#include "dump5892.h"
+
+static bool has_serial1 = false;
+static char gnssbuf[GNSS_MAX_SENTENCE+1];
+static int gnsschars = 0;
+
+// the checksum after the '*' is the XOR of all between the '$' and the '*'
+// - it is optional, so that sentences can be typed in by hand
+static bool nmea_checksum(char *s)
+{
+    char *star = strchr(s, '*');
+    if (star == NULL)
+        return true;
+    uint8_t x = 0;
+    for (char *p = s+1; p < star; p++)
+        x ^= (uint8_t) *p;
+    *star = '\0';
+    return (strtoul(star+1, NULL, 16) == x);
+}
+
+// ddmm.mmmm (or dddmm.mmmm for longitude) and N/S/E/W to degrees
+static bool nmea_angle(const char *val, const char *hemi, float *deg)
+{
+    if (*val == '\0' || *hemi == '\0')
+        return false;
+    double x = atof(val);
+    int d = (int) (x / 100);
+    x = d + (x - 100*d) / 60.0;
+    if (*hemi == 'S' || *hemi == 'W')
+        x = -x;
+    *deg = (float) x;
+    return true;
+}
+
+// one sentence (without the CR-LF), returns whether it had a position
+bool gnss_sentence(char *s)
+{
+    if (s[0] != '$' || strlen(s) < 7)
+        return false;
+    if (! nmea_checksum(s)) {
+        ++gnss_rejects;
+        return false;
+    }
+    bool gga = (strncmp(s+3, "GGA,", 4) == 0);
+    bool rmc = (strncmp(s+3, "RMC,", 4) == 0);
+    if (! gga && ! rmc)
+        return false;           // other sentences are of no interest
+
+    // split into fields - which may be empty, so not with strtok()
+    char *field[16];
+    int n = 0;
+    char *p = s;
+    while (n < 16) {
+        field[n++] = p;
+        p = strchr(p, ',');
+        if (p == NULL)
+            break;
+        *p++ = '\0';
+    }
+
+    float lat, lon;
+    bool fix;
+    if (gga)     // $--GGA,time,lat,N/S,lon,E/W,quality(0=none),...
+        fix = (n > 6 && field[6][0] > '0'
+              && nmea_angle(field[2], field[3], &lat)
+              && nmea_angle(field[4], field[5], &lon));
+    else         // $--RMC,time,status(A=valid),lat,N/S,lon,E/W,...
+        fix = (n > 6 && field[2][0] == 'A'
+              && nmea_angle(field[3], field[4], &lat)
+              && nmea_angle(field[5], field[6], &lon));
+    if (! fix) {
+        ++gnss_rejects;
+        return false;
+    }
+    ++gnss_fixes;
+    if (CPRRelative_update(lat, lon)) {
+if(settings->debug)
+Serial.printf("> reference location now %.5f, %.5f\n", lat, lon);
+    }
+    return true;
+}
+
+void gnss_setup()
+{
+    if (settings->gnss_pin > 39)      // 255 = none
+        return;
+    Serial1.begin(GNSS_BR, SERIAL_8N1, settings->gnss_pin, -1);
+    has_serial1 = true;
+}
+
+void gnss_loop()
+{
+    if (! has_serial1)
+        return;
+    while (Serial1.available()) {
+        char c = Serial1.read();
+        if (c == '$') {                 // (re)start
+            gnsschars = 0;
+        } else if (c == '\r' || c == '\n') {
+            if (gnsschars > 0) {
+                gnssbuf[gnsschars] = '\0';
+                gnss_sentence(gnssbuf);
+            }
+            gnsschars = 0;
+            continue;
+        } else if (gnsschars == 0 || gnsschars >= GNSS_MAX_SENTENCE) {
+            gnsschars = 0;              // skip to the next '$'
+            continue;
+        }
+        gnssbuf[gnsschars++] = c;
+    }
+}
@@ -32,13 +32,41 @@
 #define byte2hex_msb(b) hex[((b)>>4)&0x0F]
 #define byte2hex_lsb(b) hex[(b)&0x0F]
 
-// assume the data is always valid and uppercase
-//int hex2bin(char c) {
-//    if (c >= 'A')  return (0xA + (c - 'A'));
-//    return (c - '0');
-//}
-// make this inline:
-#define hex2bin(c) (((c)>='A')? (0xA+((c)-'A')) : ((c)-'0'))
+// hex digit values, 0x80 marks a char that is not a hex digit
+static const uint8_t hexval[256] = {
+    0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,
+    0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,
+    0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,
+       0,   1,   2,   3,   4,   5,   6,   7,   8,   9,0x80,0x80,0x80,0x80,0x80,0x80,
+    0x80,  10,  11,  12,  13,  14,  15,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,
+    0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,
+    0x80,  10,  11,  12,  13,  14,  15,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,
+    0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,
+    0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,
+    0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,
+    0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,
+    0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,
+    0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,
+    0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,
+    0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,
+    0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80
+};
+
+// Convert nbytes*2 hex digits into nbytes binary bytes in msg[], all in one pass.
+// Invalid digits are not tested one at a time: their 0x80 flags are ORed
+// together and checked once at the end.  Returns false if any char was invalid.
+static bool hex_decode(const char *p, int nbytes)
+{
+    uint8_t bad = 0;
+    for (int j=0; j<nbytes; j++) {
+        uint8_t hi = hexval[(uint8_t) p[0]];
+        uint8_t lo = hexval[(uint8_t) p[1]];
+        bad |= (hi | lo);
+        msg[j] = (hi << 4) | lo;
+        p += 2;
+    }
+    return ((bad & 0x80) == 0);
+}
 
 
 // decode Gillham ("Gray") coded altitude
@@ -185,6 +213,123 @@ static bool parse_identity(bool justparse, char s)
 }
 
 
+// The aircraft whose positions were lately rejected as out of range or at
+// the wrong altitude: the same ones keep sending every second or so, and
+// parse() drops their next positions from just the ICAO ID in the hex,
+// for settings->negttl seconds.  Only a verdict that cannot change within
+// that time is remembered - beyond the limits by more than an airliner
+// could close in it - and only once a second position agrees, so that a
+// single corrupted frame does not hide an aircraft.  2-way set-associative,
+// the one expiring first is replaced.  Settings commands empty it.
+
+#define NEGCACHE_BITS   5
+#define NEGCACHE_SETS   (1 << NEGCACHE_BITS)
+#define NEGCACHE_VALID  0x01000000     // in the key - ICAO IDs are 24 bits
+#define NEGCACHE_SURE   0x02000000     // rejected twice - drop its positions
+
+#define NEG_CLOSING_NM  0.2            // nm per second - 720 knots
+#define NEG_CLIMB_FT    100            // feet per second - 6000 fpm
+#define NEG_CLOSING_CPR ((int32_t) (NEG_CLOSING_NM * (1<<16) / 180.0))
+
+typedef struct negent {
+    uint32_t key;        // ICAO ID | NEGCACHE_VALID (| NEGCACHE_SURE), 0 if empty
+    uint32_t until;      // millis()
+} negent_t;
+
+static negent_t negcache[NEGCACHE_SETS][2];
+
+static inline negent_t *negcache_set(uint32_t addr)
+{
+    return negcache[(addr * 2654435769u) >> (32 - NEGCACHE_BITS)];
+}
+
+void negcache_clear()
+{
+    memset(negcache, 0, sizeof(negcache));
+}
+
+static bool negcache_hit(uint32_t addr)
+{
+    negent_t *e = negcache_set(addr);
+    uint32_t key = (addr | NEGCACHE_VALID);
+    for (int w=0; w < 2; w++) {
+        if ((e[w].key & ~NEGCACHE_SURE) == key) {
+            if ((int32_t) (e[w].until - millis()) <= 0) {
+                e[w].key = 0;
+                ++negcache_expired;
+                return false;
+            }
+            if (e[w].key & NEGCACHE_SURE) {
+                ++negcache_hits;
+                return true;
+            }
+            break;
+        }
+    }
+    ++negcache_misses;
+    return false;
+}
+
+// reject the position of fo.addr - and remember it if the verdict is lasting
+static bool rejected(bool lasting)
+{
+    if (! lasting || settings->negttl == 0 || fo.addr == settings->follow)
+        return false;
+    negent_t *e = negcache_set(fo.addr);
+    uint32_t key = (fo.addr | NEGCACHE_VALID);
+    uint32_t now = millis();
+    int w;
+    if ((e[0].key & ~NEGCACHE_SURE) == key || e[0].key == 0)
+        w = 0;
+    else if ((e[1].key & ~NEGCACHE_SURE) == key || e[1].key == 0)
+        w = 1;
+    else
+        w = ((int32_t) (e[0].until - e[1].until) <= 0 ? 0 : 1);
+    if (e[w].key == key && (int32_t) (e[w].until - now) > 0)
+        key |= NEGCACHE_SURE;           // second time
+    e[w].key = key;
+    e[w].until = now + 1000 * settings->negttl;
+    return false;
+}
+
+// fo.distance and fo.bearing of the position decoded into fo and mm,
+// returns whether it is within range
+static bool position_range(const cprref_t *ref)
+{
+#if defined(DSTBRG_GRID)
+    dstbrg_lookup(ref);                      // fo.distance and fo.bearing
+#else
+    uint32_t y = (uint32_t)((111300.0 * 0.53996) * (fo.latitude - ref->reflat)); // nm * 1000
+    uint32_t x = (uint32_t)((111300.0 * 0.53996) * (fo.longitude - ref->reflon) * CosLat(ref->reflat));
+    fo.distance = 0.001 * (float)iapproxHypotenuse1(x, y);
+#endif
+    int far = 1;
+    if (fo.distance < 6.0)
+        far = 0;
+    else if (fo.distance > 30.0)
+        far = 2;
+    ++msg_by_dst_cat[far];
+    // note that distance stats skip the too-far ones rejected earlier using maxcprdiff
+    // filter by distance, but always include "followed" aircraft
+    if (fo.addr != settings->follow) {
+        if (fo.distance < (float)settings->minrange)
+            return rejected(fo.distance < (float)settings->minrange - NEG_CLOSING_NM * settings->negttl);
+        // (too far, after getting past the CPR checks: borderline, or decoded wrong)
+        if (fo.distance > (float)settings->maxrange)
+            return rejected(false);
+    }
+#if !defined(DSTBRG_GRID)
+    if (fo.distance == 0) {
+        fo.bearing = 0;
+    } else {
+        fo.bearing = iatan2_approx(y,x);
+        if (fo.bearing < 0)
+            fo.bearing += 360;
+    }
+#endif
+    return true;
+}
+
 static bool parse_position(bool justparse, char s)
 {
     int k = parsedchars;
@@ -197,8 +342,9 @@ static bool parse_position(bool justparse, char s)
     // Most receiveable signals are from farther away than we may be interested in.
     // An efficient way to filter them out at this early stage will save a lot of CPU cycles.
 
+    const cprref_t *ref = cpr_reference();    // the same one all the way through
     int32_t m = (int32_t) mm.cprlat;
-    int32_t r = (int32_t) ourcprlat[mm.fflag];   // convert from unsigned to signed...
+    int32_t r = (int32_t) ref->ourcprlat[mm.fflag];   // convert from unsigned to signed...
     if (m-r > (1<<16)) {
         // maybe it's just wraparound on the edge of the zone
         // - choose the closer interpretation
@@ -214,40 +360,41 @@ Serial.println("lat wraparound up...");
     int32_t abslatdiff = abs(cprlatdiff);
     if (abslatdiff > maxcprdiff) {        // since even just lat diff is too far
       if (fo.addr != settings->follow)
-        return false;                     // no need to compute slant distance
+        return rejected(abslatdiff > maxcprdiff + NEG_CLOSING_CPR * settings->negttl);
+                                          // no need to compute slant distance
     }
 
     // identify the NL zone, ours, an adjacent one, or beyond
     bool adjacent = true;
-    if (reflat < 7.5 && reflat > 7.5) {              // one big NL zone around the equator
-        r = (int32_t) ourcprlon[mm.fflag];
-    } else if (reflat > 0) {
-      if (m < cprNL1lat[mm.fflag]) {                 // target lat in higher-NL zone
-        if (m < cprPluslat[mm.fflag]) {              // beyond the adjacent zone
+    if (ref->reflat < 7.5 && ref->reflat > 7.5) {    // one big NL zone around the equator
+        r = (int32_t) ref->ourcprlon[mm.fflag];
+    } else if (ref->reflat > 0) {
+      if (m < ref->cprNL1lat[mm.fflag]) {            // target lat in higher-NL zone
+        if (m < ref->cprPluslat[mm.fflag]) {              // beyond the adjacent zone
             adjacent = false;
         }
-        r = (int32_t) ourcprlonPlus[mm.fflag];
-      } else if (m > cprNL0lat[mm.fflag]) {          // target lat in lower-NL zone
-        if (m > cprMinuslat[mm.fflag]) {             // beyond the adjacent zone
+        r = (int32_t) ref->ourcprlonPlus[mm.fflag];
+      } else if (m > ref->cprNL0lat[mm.fflag]) {     // target lat in lower-NL zone
+        if (m > ref->cprMinuslat[mm.fflag]) {             // beyond the adjacent zone
             adjacent = false;
         }
-        r = (int32_t) ourcprlonMinus[mm.fflag];
+        r = (int32_t) ref->ourcprlonMinus[mm.fflag];
       } else {
-        r = (int32_t) ourcprlon[mm.fflag];
+        r = (int32_t) ref->ourcprlon[mm.fflag];
       }
     } else {                                         // reflat < 0
-      if (m > cprNL1lat[mm.fflag]) {                 // in higher-NL zone (towards equator)
-        if (m > cprPluslat[mm.fflag]) {              // beyond the adjacent zone
+      if (m > ref->cprNL1lat[mm.fflag]) {            // in higher-NL zone (towards equator)
+        if (m > ref->cprPluslat[mm.fflag]) {              // beyond the adjacent zone
             adjacent = false;
         }
-        r = (int32_t) ourcprlonPlus[mm.fflag];
-      } else if (m < cprNL0lat[mm.fflag]) {          // in lower-NL zone (towards south pole)
-        if (m < cprMinuslat[mm.fflag]) {             // beyond the adjacent zone
+        r = (int32_t) ref->ourcprlonPlus[mm.fflag];
+      } else if (m < ref->cprNL0lat[mm.fflag]) {     // in lower-NL zone (towards south pole)
+        if (m < ref->cprMinuslat[mm.fflag]) {             // beyond the adjacent zone
             adjacent = false;
         }
-        r = (int32_t) ourcprlonMinus[mm.fflag];
+        r = (int32_t) ref->ourcprlonMinus[mm.fflag];
       } else {
-        r = (int32_t) ourcprlon[mm.fflag];
+        r = (int32_t) ref->ourcprlon[mm.fflag];
       }
     }
     m = (int32_t) mm.cprlon;
@@ -264,15 +411,17 @@ Serial.println("lon wraparound up...");
     int32_t abslondiff = abs(cprlondiff);
     if (adjacent) {
       if (fo.addr != settings->follow) {
+        int32_t negdiff = maxcprdiff + NEG_CLOSING_CPR * settings->negttl;
         if (abslondiff > maxcprdiff)
-            return false;
+            return rejected(abslondiff > negdiff);
         // weed out remaining too-far using pre-computed squared-hypotenuse
         // - no need to compute the un-squared distance at this point
         // - will compute more exact distance later using hypotenus-approximation
         abslatdiff >>= 4;
         abslondiff >>= 4;
-        if (abslatdiff*abslatdiff + abslondiff*abslondiff > maxcprdiff_sq)
-            return false;
+        int32_t d_sq = abslatdiff*abslatdiff + abslondiff*abslondiff;
+        if (d_sq > maxcprdiff_sq)
+            return rejected(d_sq > (negdiff >> 4) * (negdiff >> 4));
       }
     } else {
 if (settings->debug)
@@ -297,26 +446,27 @@ Serial.printf("position: non-adjacent, distance unknown\n");
 
     // filter by altitude, but always include "followed" aircraft
     if (settings->alts != ALLALTS && fo.addr != settings->follow) {
+        int margin = NEG_CLIMB_FT * settings->negttl;
         if (fo.altitude == 0) {
             // altitude not known
             //--msg_by_dst_cat[far];    // try and undo the increment earlier
             //--msg_by_alt_cat[0];
-            return false;
+            return rejected(false);
         }
         if (settings->alts == LOWALT && fo.altitude > 18000) {
             //--msg_by_dst_cat[far];    // try and undo the increment earlier
             //--msg_by_alt_cat[2];
-            return false;
+            return rejected(fo.altitude > 18000 + margin);
         }
         if (settings->alts == MEDALT && fo.altitude < 18000) {
             //--msg_by_dst_cat[far];
             //--msg_by_alt_cat[1];
-            return false;
+            return rejected(fo.altitude < 18000 - margin);
         }
         if (settings->alts == HIGHALT && fo.altitude < 50000) {
             //--msg_by_dst_cat[far];
             //--msg_by_alt_cat[fo.altitude < 18000? 1 : 2];
-            return false;
+            return rejected(fo.altitude < 50000 - margin);
         }
     }
 
@@ -345,35 +495,16 @@ Serial.printf("position: non-adjacent, distance unknown\n");
         parsed[k++] = hex[(mm.cprlon & 0x0000F)];
 
     } else {
-        if (decodeCPRrelative() < 0) {           // error decoding lat/lon
+        PRF_START(t);
+        int effort = decodeCPR(ref);
+        PRF_STOP(PRF_CPR, t);
+        if (effort < 0) {                        // error decoding lat/lon
             //fo.distance = 0;
             //fo.bearing = 0;
             return false;
         }
-        uint32_t y = (uint32_t)((111300.0 * 0.53996) * (fo.latitude - reflat)); // nm * 1000
-        uint32_t x = (uint32_t)((111300.0 * 0.53996) * (fo.longitude - reflon) * CosLat(reflat));
-        fo.distance = 0.001 * (float)iapproxHypotenuse1(x, y);
-        int far = 1;
-        if (fo.distance < 6.0)
-            far = 0;
-        else if (fo.distance > 30.0)
-            far = 2;
-        ++msg_by_dst_cat[far];
-        // note that distance stats skip the too-far ones rejected earlier using maxcprdiff
-        // filter by distance, but always include "followed" aircraft
-        if (fo.addr != settings->follow) {
-            if (fo.distance < (float)settings->minrange)
-                return false;
-            if (fo.distance > (float)settings->maxrange)
-                return false;
-        }
-        if (fo.distance == 0) {
-            fo.bearing = 0;
-        } else {
-            fo.bearing = iatan2_approx(y,x);
-            if (fo.bearing < 0)
-                fo.bearing += 360;
-        }
+        if (! position_range(ref))
+            return false;
         update_traffic_position();
     }
 
@@ -381,6 +512,101 @@ Serial.printf("position: non-adjacent, distance unknown\n");
     return true;
 }
 
+// ground speed in knots from the 7-bit "movement" field of surface
+// positions, which is in ever coarser steps: 1/8 knot up to 1, then 1/4 up
+// to 2, 1/2 up to 15, 1 up to 70, 2 up to 100, 5 up to 175 - in 1/8 knot
+static const struct {
+    uint8_t  start;       // the first code in a step size
+    uint8_t  step;        // in 1/8 knot
+    uint16_t speed;       // at the start, in 1/8 knot
+} movement_steps[] = {
+    {   2,  1,    1 },
+    {   9,  2,    8 },
+    {  13,  4,   16 },
+    {  39,  8,  120 },
+    {  94, 16,  560 },
+    { 109, 40,  800 },
+    { 124,  0, 1400 },    // 175 knots or more
+};
+
+static int movement_speed(int movement)
+{
+    if (movement < 2 || movement > 124)
+        return 0;         // 0 no info, 1 stopped, 125-127 reserved
+    int k = 0;
+    while (k < 6 && movement >= movement_steps[k+1].start)
+        k++;
+    int v = movement_steps[k].speed + (movement - movement_steps[k].start) * movement_steps[k].step;
+    return ((v + 4) >> 3);
+}
+
+// surface position messages (TC 5-8): CPR position as in airborne ones
+// but of 1/4 the zone size, ground speed and track instead of altitude
+static bool parse_surface(bool justparse, char s)
+{
+    int k = parsedchars;
+
+    int movement = ((msg[4] & 7) << 4) | (msg[5] >> 4);
+    int trk_valid = ((msg[5] & 0x08) >> 3);
+    int itrack = ((msg[5] & 7) << 4) | (msg[6] >> 4);
+    mm.fflag = ((msg[6] & 0x4) >> 2);
+    mm.cprlat = ((msg[6] & 3) << 15) | (msg[7] << 7) | (msg[8] >> 1);
+    mm.cprlon = ((msg[8]&1) << 16) | (msg[9] << 8) | msg[10];
+
+    // filter by altitude: on the ground is below any altitude band but the lowest
+    if (settings->alts != ALLALTS && settings->alts != LOWALT && fo.addr != settings->follow)
+        return rejected(true);        // will not get there any time soon
+
+    if (justparse) {
+        parsed[k++] = byte2hex_msb(movement);
+        parsed[k++] = byte2hex_lsb(movement);
+        parsed[k++] = s;
+        uint8_t b = (trk_valid << 7) | itrack;
+        parsed[k++] = byte2hex_msb(b);
+        parsed[k++] = byte2hex_lsb(b);
+        parsed[k++] = s;
+        parsed[k++] = hex[(msg[6] & 0x8) >> 3];    // tflag
+        parsed[k++] = s;
+        parsed[k++] = hex[mm.fflag];
+        parsed[k++] = s;
+        parsed[k++] = hex[(mm.cprlat & 0x10000) >> 16];
+        parsed[k++] = hex[(mm.cprlat & 0x0F000) >> 12];
+        parsed[k++] = hex[(mm.cprlat & 0x00F00) >>  8];
+        parsed[k++] = hex[(mm.cprlat & 0x000F0) >>  4];
+        parsed[k++] = hex[(mm.cprlat & 0x0000F)];
+        parsed[k++] = s;
+        parsed[k++] = hex[(mm.cprlon & 0x10000) >> 16];
+        parsed[k++] = hex[(mm.cprlon & 0x0F000) >> 12];
+        parsed[k++] = hex[(mm.cprlon & 0x00F00) >>  8];
+        parsed[k++] = hex[(mm.cprlon & 0x000F0) >>  4];
+        parsed[k++] = hex[(mm.cprlon & 0x0000F)];
+
+    } else {
+        const cprref_t *ref = cpr_reference();
+        PRF_START(t);
+        int effort = decodeCPRsurface(ref);
+        PRF_STOP(PRF_CPR, t);
+        if (effort < 0)
+            return false;
+        if (! position_range(ref))
+            return false;
+        fo.groundspeed = movement_speed(movement);
+        fo.track_is_valid = trk_valid;
+        if (trk_valid) {
+            fo.track = ((itrack * 360 + 64) >> 7);
+            if (fo.track >= 360)
+                fo.track -= 360;
+            // the components too, as from airborne velocity messages
+            fo.nsv = (int16_t) (fo.groundspeed * cos_approx((float) fo.track));
+            fo.ewv = (int16_t) (fo.groundspeed * sin_approx((float) fo.track));
+        }
+        update_traffic_surface();
+    }
+
+    parsedchars = k;
+    return true;
+}
+
 static bool parse_velocity(bool justparse, char s)
 {
     int k = parsedchars;
@@ -599,6 +825,195 @@ altitude bits:            ^ ^^^^ ^^^^ ^^^^
     return true;
 }
 
+// Comm-B replies (DF 20/21): the 56-bit MB field holds whichever register
+// (BDS) the ground station asked for, and does not say which.  Each of the
+// three usual ones is scored for how plausible the fields come out: -1 if
+// any is out of bounds (or a reserved bit or a missing field is not zero),
+// else 1 per field present, and more for agreeing with what the aircraft
+// itself said in its ADS-B velocity.  The best score wins, if it is alone.
+
+#define MB(first, n)  ((uint32_t) (mb >> (57 - (first) - (n))) & ((1u << (n)) - 1))
+
+static inline int32_t sext(uint32_t v, int n)
+{
+    return ((int32_t) (v << (32-n)) >> (32-n));
+}
+
+// 11-bit signed angle (90/512 degree) to degrees 0-359
+static inline int angle11(uint32_t v)
+{
+    int a = ((v & 0x7FF) * 360 + 1024) >> 11;     // the negative ones wrap around
+    return (a >= 360 ? a - 360 : a);
+}
+
+static inline int angle_diff(int a, int b)
+{
+    int d = abs(a - b);
+    return (d > 180 ? 360 - d : d);
+}
+
+// BDS 4,0 - selected vertical intention
+static int score_bds40(uint64_t mb)
+{
+    if (MB(40, 8) != 0 || MB(52, 2) != 0)
+        return -1;
+    uint32_t mcp  = MB(2, 12) * 16;       // feet
+    uint32_t fms  = MB(15, 12) * 16;
+    uint32_t baro = MB(28, 12);           // tenths of mb above 800
+    if ((MB(1, 1) == 0 && mcp) || (MB(14, 1) == 0 && fms) || (MB(27, 1) == 0 && baro)
+     || (MB(48, 1) == 0 && MB(49, 3)) || (MB(54, 1) == 0 && MB(55, 2)))
+        return -1;
+    int score = 0;
+    if (mcp) {
+        if (mcp > 50000)
+            return -1;
+        ++score;
+    }
+    if (fms) {
+        if (fms > 50000)
+            return -1;
+        ++score;
+    }
+    if (baro) {
+        if (baro < 1000 || baro > 3000)    // 900 to 1100 mb
+            return -1;
+        ++score;
+    }
+    return score;
+}
+
+// BDS 5,0 - track and turn
+static int score_bds50(uint64_t mb, const velocity_t *fop)
+{
+    int32_t roll = sext(MB(2, 10), 10);   // 45/256 degree
+    uint32_t trk = MB(13, 11);
+    int gs = MB(25, 10) * 2;              // knots
+    int32_t rate = sext(MB(36, 10), 10);  // 8/256 degree per second
+    int tas = MB(47, 10) * 2;
+    if ((MB(1, 1) == 0 && roll) || (MB(12, 1) == 0 && trk) || (MB(24, 1) == 0 && gs)
+     || (MB(35, 1) == 0 && rate) || (MB(46, 1) == 0 && tas))
+        return -1;
+    if (abs(roll) > 285 || gs > 700 || abs(rate) > 320 || tas > 600)    // 50 deg, 10 deg/s
+        return -1;
+    if (gs && tas && abs(gs - tas) > 200)
+        return -1;
+    int score = MB(1, 1) + MB(12, 1) + MB(24, 1) + MB(35, 1) + MB(46, 1);
+    if (fop->velocitytime != 0) {
+        if (gs && abs(gs - fop->groundspeed) <= 20)
+            score += 2;
+        if (trk && fop->track_is_valid && angle_diff(angle11(trk), fop->track) <= 10)
+            score += 2;
+    }
+    return score;
+}
+
+// BDS 6,0 - heading and speed
+static int score_bds60(uint64_t mb, const velocity_t *fop)
+{
+    uint32_t hdg = MB(2, 11);
+    int ias = MB(14, 10);                 // knots
+    int mach = MB(25, 10) * 4;            // thousandths
+    int32_t vr = sext(MB(36, 10), 10) * 32;    // feet per minute
+    int32_t ivr = sext(MB(47, 10), 10) * 32;
+    if ((MB(1, 1) == 0 && hdg) || (MB(13, 1) == 0 && ias) || (MB(24, 1) == 0 && mach)
+     || (MB(35, 1) == 0 && vr) || (MB(46, 1) == 0 && ivr))
+        return -1;
+    if (ias > 500 || mach > 1000 || abs(vr) > 6000 || abs(ivr) > 6000)
+        return -1;
+    if (ias && mach && (mach * 10 < ias * 12 || mach * 10 > ias * 45))
+        return -1;     // Mach/IAS from sea level to 45,000 ft
+    int score = MB(1, 1) + MB(13, 1) + MB(24, 1) + MB(35, 1) + MB(46, 1);
+    if (fop->velocitytime != 0) {
+        if (MB(35, 1) && abs(vr - fop->vert_rate) <= 500)
+            score += 2;
+        if (hdg && fop->track_is_valid && angle_diff(angle11(hdg), fop->track) <= 30)
+            score += 1;    // (magnetic heading vs. true track)
+    }
+    return score;
+}
+
+// fills in fo.sel_alt etc, returns 0x40, 0x50, 0x60, or 0 if unsure
+static int infer_bds(const velocity_t *fop)
+{
+    uint64_t mb = 0;
+    for (int j=4; j < 11; j++)
+        mb = (mb << 8) | msg[j];
+    if (mb == 0 || msg[4] == 0x10 || msg[4] == 0x20 || msg[4] == 0x30)
+        return 0;      // empty, or BDS 1,0 / 2,0 / 3,0 which say so
+    int s40 = score_bds40(mb);
+    int s50 = score_bds50(mb, fop);
+    int s60 = score_bds60(mb, fop);
+    int best = (s40 > s50 ? s40 : s50);
+    if (s60 > best)
+        best = s60;
+    if (best <= 0 || (s40 == best) + (s50 == best) + (s60 == best) > 1)
+        return 0;
+    if (s40 == best) {
+        uint32_t sel = MB(2, 12) * 16;    // the MCP/FCU setting, else FMS
+        if (sel == 0)
+            sel = MB(15, 12) * 16;
+        if (sel) {
+            fo.sel_alt = sel;
+            fo.commb_fields = CB_SELALT;
+        }
+        return 0x40;
+    }
+    if (s50 == best) {
+        if (MB(1, 1)) {
+            fo.roll = (int16_t) ((sext(MB(2, 10), 10) * 450) / 256);
+            fo.commb_fields |= CB_ROLL;
+        }
+        if (MB(46, 1)) {
+            fo.tas = MB(47, 10) * 2;
+            fo.airspeed = fo.tas;         // for the decoded output
+            fo.commb_fields |= CB_TAS;
+        }
+        return 0x50;
+    }
+    if (MB(1, 1)) {
+        fo.mag_heading = angle11(MB(2, 11));
+        fo.heading = fo.mag_heading;
+        fo.commb_fields |= CB_MAGHDG;
+    }
+    if (MB(13, 1)) {
+        fo.ias = MB(14, 10);
+        fo.airspeed = fo.ias;
+        fo.commb_fields |= CB_IAS;
+    }
+    if (MB(24, 1)) {
+        fo.mach = MB(25, 10) * 4;
+        fo.commb_fields |= CB_MACH;
+    }
+    if (MB(35, 1))
+        fo.vert_rate = sext(MB(36, 10), 10) * 32;
+    return 0x60;
+}
+
+// DF20/21 Comm-B replies: the altitude (DF20) as in DF4, or the squawk
+// (DF21), and the MB field.  The ICAO ID is overlaid on the parity, so
+// any bit error turns it into some other, random, address: it is only
+// trusted if the aircraft is in the table already.
+static bool parse_comm_b()
+{
+    uint32_t addr = check_crc(14);
+    int i = find_traffic_by_addr(addr);
+    if (i == 0) {
+        ++commb_addr[1];
+        return (mm.frame == 20 ? parse_mode_s_altitude() : false);    // as before
+    }
+    ++commb_addr[0];
+    fo.addr = addr;
+    if (mm.frame == 20 && ! parse_mode_s_altitude())
+        return false;
+    if (settings->follow != 0 && addr != settings->follow)
+        return false;
+    int bds = infer_bds(traffic_velocity(i-1));
+    ++msg_by_bds[bds == 0x40 ? 0 : bds == 0x50 ? 1 : bds == 0x60 ? 2 : 3];
+    if (fo.commb_fields)
+        update_comm_b_traffic();
+    return true;
+}
+
 // decode just the ICAO ID from all-call responses (DF 11)
 static bool parse_all_call()
 {
@@ -610,67 +1025,178 @@ Serial.printf("all_call: heard from ICAO ID %X\n", fo.addr);
     return true;
 }
 
+// between 0x18=24 (weak) and 0x2d=45 (strongest signals) - subtract 22
+static inline int rssi_bucket(int rssi)
+{
+    if (rssi < 22)  rssi = 22;
+    if (rssi > 46)  rssi = 46;
+    return (rssi - 22);
+}
+
+// Most of what arrives is DF17 airborne positions from too far away, which
+// parse_position() rejects by the CPR latitude alone.  This does the same
+// from just the hex digits needed - DF, TC, F and the CPR latitude - before
+// the rest of the frame is decoded, or the CRC checked.  (A frame with a
+// bad CRC may thus be rejected here rather than there, and one that could
+// have been corrected into range is lost - a small price.)  The followed
+// aircraft is never rejected.  Returns the TC, or 0 if not rejected.
+// p points to the DF, 28 hex digits.
+static int far_position(const char *p)
+{
+    // DF17 is 10001xxx: '8' and then '8' to 'F'
+    if (p[0] != '8' || (uint8_t) (hexval[(uint8_t) p[1]] - 8) > 7)
+        return 0;
+    uint8_t t1 = hexval[(uint8_t) p[8]];
+    uint8_t t0 = hexval[(uint8_t) p[9]];
+    if ((t1 | t0) & 0x80)
+        return 0;
+    int tc = (t1 << 1) | (t0 >> 3);
+    if (tc < 9 || tc > 22 || tc == 19)
+        return 0;
+
+    // msg[6] low nibble: T F lat16 lat15, then msg[7], msg[8] high 7 bits
+    uint8_t n13 = hexval[(uint8_t) p[13]];
+    uint8_t n14 = hexval[(uint8_t) p[14]];
+    uint8_t n15 = hexval[(uint8_t) p[15]];
+    uint8_t n16 = hexval[(uint8_t) p[16]];
+    uint8_t n17 = hexval[(uint8_t) p[17]];
+    if ((n13 | n14 | n15 | n16 | n17) & 0x80)
+        return 0;
+    int f = ((n13 >> 2) & 1);
+    uint32_t cprlat = ((n13 & 3) << 15) | (n14 << 11) | (n15 << 7) | (n16 << 3) | (n17 >> 1);
+
+    // more than maxcprdiff away from ours, either way around the zone
+    uint32_t d = (cprlat - cpr_reference()->ourcprlat[f] + maxcprdiff) & 0x1FFFF;
+    if (d <= (uint32_t) (2 * maxcprdiff))
+        return 0;
+
+    if (settings->follow != 0) {
+        uint32_t addr = 0;
+        for (int j=2; j < 8; j++)
+            addr = (addr << 4) | hexval[(uint8_t) p[j]];
+        if (addr == settings->follow)
+            return 0;
+    }
+    return tc;
+}
+
+// A DF17 or DF18 (CF 0 or 1) airborne or surface position from an aircraft whose
+// positions were lately rejected - see negcache_hit().  Returns its TC, or
+// 0 if not (as far as the hex digits tell).  p points to the DF.
+static int cached_reject(const char *p)
+{
+    // DF17 is '8' then '8' to 'F', DF18 is '9' then '0' to '7'
+    uint8_t d1 = hexval[(uint8_t) p[1]];
+    if (p[0] == '8' ? (uint8_t) (d1 - 8) > 7 : (p[0] != '9' || d1 > 7))
+        return 0;
+    // DF18 CF 2-6 (TIS-B, status, ADS-R) are left to the full path to sort out
+    if (p[0] == '9' && (d1 & 7) > 1)
+        return 0;
+    uint8_t t1 = hexval[(uint8_t) p[8]];
+    uint8_t t0 = hexval[(uint8_t) p[9]];
+    if ((t1 | t0) & 0x80)
+        return 0;
+    int tc = (t1 << 1) | (t0 >> 3);
+    if (tc < 5 || tc > 22 || tc == 19)
+        return 0;
+    uint32_t addr = 0;
+    uint8_t bad = 0;
+    for (int j=2; j < 8; j++) {
+        uint8_t v = hexval[(uint8_t) p[j]];
+        bad |= v;
+        addr = (addr << 4) | v;
+    }
+    if (bad & 0x80)
+        return 0;
+    return (negcache_hit(addr) ? tc : 0);
+}
+
 // assume the n chars in buf[] include the starting '*' but not the ending ';'
 
 bool parse(char *buf, int n)
 {
+    int i;
+    if (buf[0] == '*')
+        i = 1;            // point to DF
+    else if (buf[0] == '+')
+        i = 3;            // skip RSSI
+    else
+        return false;     // not a valid GNS5892 sentence
+
+    // decode the whole frame from hex right away, rejecting malformed ones
+    int nbytes;
+    if (n-i == 28) {
+        nbytes = 14;
+    } else if (n-i == 14) {
+        if (settings->dfs != DFNOTL && settings->dfs != DF20 && settings->dfs != DFSALL)
+            return false;     // not a 112-bit ES
+        nbytes = 7;
+    } else {
+        ++in_malformed;
+        return false;
+    }
+    uint8_t rssi = 0;
+    if (i == 3) {
+        uint8_t hi = hexval[(uint8_t) buf[1]];
+        uint8_t lo = hexval[(uint8_t) buf[2]];
+        if ((hi | lo) & 0x80) {
+            ++in_malformed;
+            return false;
+        }
+        rssi = (hi << 4) | lo;
+    }
+
+    // the far away positions, counted as far as they got
+    int tc;
+    if (nbytes == 14 && settings->dfs != DF18 && settings->dfs != DF20
+                     && (tc = far_position(&buf[i])) != 0) {
+        if (i == 3)
+            ++msg_by_rssi[rssi_bucket(rssi)];
+        ++msg_by_DF[17];
+        ++msg_by_hour[ourclock.hour];
+        ++msg_by_type['P'-'A'];
+        if (tc >= 20)
+            ++msg_by_type['G'-'A'];
+        ++msg_airborne;
+        ++pos_prefiltered;
+        return false;
+    }
+
+    // and those from aircraft just rejected for range or altitude
+    if (nbytes == 14 && settings->negttl != 0 && settings->follow == 0
+                     && (tc = cached_reject(&buf[i])) != 0) {
+        if (i == 3)
+            ++msg_by_rssi[rssi_bucket(rssi)];
+        ++msg_by_DF[buf[i] == '8' ? 17 : 18];
+        ++msg_by_hour[ourclock.hour];
+        if (tc <= 8) {
+            ++msg_by_type['O'-'A'];
+            ++msg_surface;
+        } else {
+            ++msg_by_type['P'-'A'];
+            if (tc >= 20)
+                ++msg_by_type['G'-'A'];
+            ++msg_airborne;
+        }
+        return false;
+    }
+
     fo = EmptyFO;   // start with a clean slate of all zeros
     mm = EmptyMsg;
     mm.msgtype = ' ';
+    fo.rssi = rssi;
     bool justparse = (settings->parsed == FLDFMT);
     char s = (settings->format==TXTFMT? ' ' : settings->format==TABFMT? '\t' : ',');
     parsedchars = 0;
     int k=0;
-    int i=1;
-    if (buf[0] == '*') {
-        if (n != 29 && (settings->dfs != DFNOTL && settings->dfs != DF20 && settings->dfs != DFSALL))
-            return false;     // not a 112-bit ES
-        if (justparse) {
-            parsed[0] = buf[1];    // DF & CA
-            parsed[1] = buf[2];
-            parsed[2] = s;
-            k = 3;
-        }
-        fo.rssi = 0;
-    } else
-    if (buf[0] == '+') {
-        if (n != 31 && (settings->dfs != DFNOTL && settings->dfs != DF20 && settings->dfs != DFSALL))
-            return false;     // not a 112-bit ES
-        fo.rssi = (hex2bin(buf[1]) << 4) | hex2bin(buf[2]);
-        int rssi_ = fo.rssi;
-        // between 0x18=24 (weak) and 0x2d=45 (strongest signals) - subtract 22
-        if (rssi_ < 22)  rssi_ = 22;
-        if (rssi_ > 46)  rssi_ = 46;
-        ++msg_by_rssi[rssi_-22];
-        i = 3;    // point to DF
-        if (justparse) {
-            parsed[0] = buf[1];    // rssi
-            parsed[1] = buf[2];
-            parsed[2] = s;
-            parsed[3] = buf[3];    // DF & CA
-            parsed[4] = buf[4];
-            parsed[5] = s;
-            k = 6;
-        }
-    }
-    else
-        return false;     // not a valid GNS5892 sentence
 
-    if (justparse) {
-        int b=i+2;        // point to ICAO ID
-        for (int m=0; m<6; m++)
-            parsed[k++] = buf[b++];
-        parsed[k++] = s;
+    if (! hex_decode(&buf[i], nbytes)) {
+        ++in_malformed;
+        return false;
     }
 
-    // parse just the first 4 bytes for now
-//    msg[0] = ((hex2bin(buf[i])) << 4) | hex2bin(buf[i+1]);
-//    i += 2;      // 2 hex chars converted into one binary byte
-    int j=0;
-    while (j < 4) {
-        msg[j++] = (hex2bin(buf[i]) << 4) | hex2bin(buf[i+1]);
-        i += 2;
-    }
+    if (i == 3)
+        ++msg_by_rssi[rssi_bucket(fo.rssi)];
 
     mm.frame = msg[0]>>3;    // Downlink Format
     if (mm.frame > 22)
@@ -697,17 +1223,14 @@ bool parse(char *buf, int n)
         } else if (mm.frame == 4) {
             mm.msgtype = 'A';
             ++msg_by_type[mm.msgtype-'A'];
-            j=4;
-            while (i < n) {
-                msg[j++] = (hex2bin(buf[i]) << 4) | hex2bin(buf[i+1]);
-                i += 2;
-            }
-            fo.addr = check_crc( j );      // assume checksum OK, extract overlayed IACO ID
+            fo.addr = check_crc( nbytes );   // assume checksum OK, extract overlayed IACO ID
             return parse_mode_s_altitude();
-        } else if (mm.frame == 20) {
-            mm.msgtype = 'B';
+        } else if (mm.frame == 20 || mm.frame == 21) {
+            mm.msgtype = (mm.frame == 20 ? 'B' : 'D');
             ++msg_by_type[mm.msgtype-'A'];
-            return parse_mode_s_altitude();
+            if (nbytes == 14)
+                return parse_comm_b();
+            return (mm.frame == 20 ? parse_mode_s_altitude() : false);
         } else if (mm.frame == 16) {
             if (dfs == DFSALL || dfs == DFNOTL) {   // but not DF20
                 mm.msgtype = 'C';
@@ -722,7 +1245,7 @@ bool parse(char *buf, int n)
                 return parse_mode_s_altitude();
             }
             return false;
-        } else {                // other frames (e.g., 21)
+        } else {                // other frames (e.g., 5)
             return false;
         }
     } else {                // dfs == D17,D18,D78 and frame is not 17 nor 18
@@ -731,22 +1254,38 @@ bool parse(char *buf, int n)
 
     // at this point only DF17 and DF18 are being processed
 
-    // convert the rest of the message from hex to binary
-    if (! settings->chk_crc)
-        n -= 6;               // skip the PI (checksum field)
-    j=4;
-    while (i < n) {
-        msg[j++] = (hex2bin(buf[i]) << 4) | hex2bin(buf[i+1]);
-        i += 2;
-    }
-
     // check CRC if desired - but only for DF=17,18
     if (settings->chk_crc) {
-        if (check_crc( j ) != 0) {
-            ++msg_by_crc_cat[1];
-            return false;
+        uint32_t syndrome = check_crc( nbytes );
+        if (syndrome != 0) {
+            int fixed = 0;
+            if (settings->fixbits)
+                fixed = fix_crc( syndrome );
+            if (fixed == 0) {
+                ++msg_by_crc_cat[1];
+                return false;
+            }
+            ++msg_by_crc_cat[1+fixed];
+        } else {
+            ++msg_by_crc_cat[0];
+        }
+    }
+
+    if (justparse) {
+        // from the (possibly corrected) binary message, not the hex input
+        if (i == 3) {
+            parsed[k++] = byte2hex_msb(fo.rssi);
+            parsed[k++] = byte2hex_lsb(fo.rssi);
+            parsed[k++] = s;
+        }
+        parsed[k++] = byte2hex_msb(msg[0]);    // DF & CA
+        parsed[k++] = byte2hex_lsb(msg[0]);
+        parsed[k++] = s;
+        for (int m=1; m<4; m++) {              // ICAO ID
+            parsed[k++] = byte2hex_msb(msg[m]);
+            parsed[k++] = byte2hex_lsb(msg[m]);
         }
-        ++msg_by_crc_cat[0];
+        parsed[k++] = s;
     }
 
 /*
@@ -805,6 +1344,18 @@ https://aviation.stackexchange.com/questions/17610/what-icao-codes-are-reserved-
         ++msg_by_type[mm.msgtype-'A'];
         return parse_identity(justparse, s);
 
+    } else if (mm.type >= 5 && mm.type <= 8) {
+
+        if (adsr)
+            mm.msgtype = 'R';
+        else if (tisb)
+            mm.msgtype = 'T';
+        else
+            mm.msgtype = 'O';  // Surface position Message (On the ground)
+        ++msg_by_type[mm.msgtype-'A'];
+        ++msg_surface;
+        return parse_surface(justparse, s);
+
     } else if (mm.type >= 9 && mm.type <= 22 && mm.type != 19) {
 
         if (adsr)
@@ -814,6 +1365,7 @@ https://aviation.stackexchange.com/questions/17610/what-icao-codes-are-reserved-
         else
             mm.msgtype = 'P';  // Airborne position Message
         ++msg_by_type[mm.msgtype-'A'];
+        ++msg_airborne;
         return parse_position(justparse, s);
 
     } else if (mm.type == 19 && mm.sub >= 1 && mm.sub <= 4) {
@@ -0,0 +1,145 @@
+/*
+ * threads.cpp
+ * Copyright (C) 2024 Moshe Braner
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version - see <http://www.gnu.org/licenses/>.
+ */
+
+// In the THREADED mode the work is split between two tasks:
+//  - the receive task: input from the GNS5892, parsing, the traffic table,
+//      and the formats of output that are based on each message,
+//  - the loop() task: writing the output to the console, the formats based
+//      on the traffic table, and the console commands.
+// The receive task hands its output over via a single-producer/single-consumer
+// queue, and only it writes into the traffic table (see the seqlock in
+// traffic.cpp).  The loop() task reads entries only by traffic_snapshot(),
+// after finding them by the single atomic fields - traffic_addr() and the
+// like, and the top of the closest-first heap - which it checks against the
+// snapshot; when each entry was last shown it keeps to itself.
+// The loop() task may hold the receive task still, between its passes, while
+// a command changes settings or the traffic table.
+
+#include "dump5892.h"
+
+#if defined(THREADED)
+
+#if !defined(ARDUINO)
+#include <thread>
+#endif
+
+static outrec_t outq[OUTQ_SIZE];
+static uint32_t outq_head = 0;   // next to be read, written by the output task
+static uint32_t outq_tail = 0;   // next to be filled, written by the receive task
+
+// the next free slot in the queue, if any
+static outrec_t *outq_slot()
+{
+    uint32_t head = __atomic_load_n(&outq_head, __ATOMIC_ACQUIRE);
+    if (outq_tail - head >= OUTQ_SIZE) {
+        ++outq_full;
+        return NULL;
+    }
+    return &outq[outq_tail & (OUTQ_SIZE-1)];
+}
+
+static void outq_commit()
+{
+    uint32_t depth = outq_tail + 1 - __atomic_load_n(&outq_head, __ATOMIC_RELAXED);
+    if (depth > (uint32_t) outq_maxdepth)
+        outq_maxdepth = depth;
+    __atomic_store_n(&outq_tail, outq_tail+1, __ATOMIC_RELEASE);
+}
+
+bool outq_text(const char *p, int n)
+{
+    outrec_t *r = outq_slot();
+    if (r == NULL)
+        return false;
+    if (n > OUTQ_TEXT)
+        n = OUTQ_TEXT;
+    r->kind = OUTREC_TEXT;
+    r->len = n;
+    memcpy(r->text, p, n);
+    outq_commit();
+    return true;
+}
+
+bool outq_decoded(ufo_t *f, mm_t *m)
+{
+    outrec_t *r = outq_slot();
+    if (r == NULL)
+        return false;
+    r->kind = OUTREC_DECODED;
+    r->frame = m->frame;
+    r->msgtype = m->msgtype;
+    r->fo = *f;
+    outq_commit();
+    return true;
+}
+
+// the oldest record in the queue, stays there until outq_release()
+outrec_t *outq_peek()
+{
+    if (outq_head == __atomic_load_n(&outq_tail, __ATOMIC_ACQUIRE))
+        return NULL;
+    return &outq[outq_head & (OUTQ_SIZE-1)];
+}
+
+void outq_release()
+{
+    __atomic_store_n(&outq_head, outq_head+1, __ATOMIC_RELEASE);
+}
+
+static bool started = false;
+static bool hold_req = false;    // set by the loop() task
+static bool held = false;        // set by the receive task in response
+
+// called from the loop() task, returns once the receive task is idle
+void rx_hold(bool hold)
+{
+    if (! started)
+        return;
+    if (hold) {
+        __atomic_store_n(&hold_req, true, __ATOMIC_SEQ_CST);
+        while (! __atomic_load_n(&held, __ATOMIC_SEQ_CST))
+            delay(1);
+    } else {
+        __atomic_store_n(&hold_req, false, __ATOMIC_SEQ_CST);
+    }
+}
+
+static void rx_task(void *param)
+{
+    uint32_t lastdelay = millis();
+    for (;;) {
+        if (__atomic_load_n(&hold_req, __ATOMIC_SEQ_CST)) {
+            __atomic_store_n(&held, true, __ATOMIC_SEQ_CST);
+            while (__atomic_load_n(&hold_req, __ATOMIC_SEQ_CST))
+                delay(1);
+            __atomic_store_n(&held, false, __ATOMIC_SEQ_CST);
+            continue;
+        }
+        // give up the CPU when there is no input waiting, and also every
+        // now and then when there is, to keep the idle task (and watchdog) happy
+        if (rx_loop() == false || millis() - lastdelay > 50) {
+            delay(1);
+            lastdelay = millis();
+        }
+    }
+}
+
+void threads_setup()
+{
+    started = true;
+#if defined(ARDUINO)
+    // loop() runs on core 1 (ARDUINO_RUNNING_CORE), this goes on core 0
+    xTaskCreatePinnedToCore(rx_task, "rx5892", 8192, NULL, 1, NULL, 0);
+#else
+    std::thread(rx_task, (void *) NULL).detach();
+#endif
+}
+
+#endif  // THREADED
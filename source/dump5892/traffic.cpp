@@ -11,45 +11,773 @@
 #include "dump5892.h"
 #include "ApproxMath.h"
 
-// A simple hash table to more quickly find IDs in container[]:
-// zero means not present, otherwise *base-1* index into container[].
-static uint8_t acindex[256] = {0};
-
-// Info on farthest aircraft, potentially to be replaced with a new closer one
-static struct {
-    float dist;
-    uint32_t addr;
-    uint8_t index1;
-} farthest = {0, 0, 0};
-// Info on closest aircraft
-static struct {
-    float dist;
-    uint32_t addr;
-    uint8_t index1;
-} closest = {9999.9, 0, 0};
+// The traffic table is a structure of arrays, all indexed alike.  The
+// sweeps over it - output_list(), the search by ID - only
+// look at the "hot" fields in container[], 16 bytes an entry, 8 entries in
+// two cache lines.  The rest is in "cold" arrays, each written by one kind
+// of message, so that a message only touches its entry in container[] and
+// its own part of the rest.  Other files get at it through traffic_snapshot()
+// and the other accessors below, never directly.
+//
+// With COMPACT_TABLE the times (timenow, in seconds) are kept in 16 bits, as
+// seconds since an epoch that is moved forward every 4.5 hours, see
+// roll_epoch(), and the rest packed as noted, to about 2/3 of the size.
+// The conversions are in to_stamp() and the like, which are no-ops without.
+#if defined(COMPACT_TABLE)
+typedef uint16_t stamp_t;
+typedef int16_t  alt_t;      // 25-ft units, or meters for GNSS heights
+#else
+typedef uint32_t stamp_t;
+typedef uint32_t alt_t;
+#endif
+
+typedef struct {
+    uint32_t  addr;          // the 24-bit ICAO ID, 0 for an empty entry
+    stamp_t   positiontime;  // timenow, as in ufo_t
+    uint16_t  distance;      // tenths of nm - see pack_dist()
+    int16_t   bearing;
+    uint16_t  next;          // links the empty entries
+} slot_t;
+
+#if defined(COMPACT_TABLE)
+typedef struct {
+    uint8_t   callsign[6];          // 8 characters of 6 bits, see pack_callsign()
+    uint8_t   aircraft_type : 4;
+    uint8_t   has_callsign : 1;     // (the rssi is never set in the table)
+} identity_t;
+
+typedef struct {
+    uint32_t  sel_alt : 16;         // as in ufo_t
+    uint32_t  mag_heading : 9;
+    uint32_t  commb_fields : 6;
+    int32_t   roll : 11;
+    uint32_t  tas : 11;
+    uint32_t  ias : 10;
+    uint16_t  mach;
+    stamp_t   commbtime;
+} commb_t;
+#else
+typedef struct {
+    char      callsign[10];
+    uint8_t   aircraft_type;
+    uint8_t   rssi;
+} identity_t;
+
+typedef struct {
+    uint32_t  commbtime;
+    uint16_t  sel_alt;       // as in ufo_t
+    int16_t   roll;
+    int16_t   tas;
+    int16_t   ias;
+    uint16_t  mach;
+    int16_t   mag_heading;
+    uint8_t   commb_fields;
+} commb_t;
+#endif
+
+typedef struct {
+    stamp_t   firsttime;     // of the positions counted
+    uint16_t  heard;         // see count_heard()
+} rate_t;
+
+static slot_t      container[TRAFFIC_SLOTS];
+static cpr_track_t tracks[TRAFFIC_SLOTS];       // from position messages
+static alt_t       altitudes[TRAFFIC_SLOTS];    //   and Mode S altitude replies
+static uint8_t     alt_types[TRAFFIC_SLOTS];
+static velocity_t  velocities[TRAFFIC_SLOTS];   // from velocity messages
+static identity_t  identities[TRAFFIC_SLOTS];   // from identity messages
+static commb_t     commbs[TRAFFIC_SLOTS];       // from Comm-B replies
+static rate_t      rates[TRAFFIC_SLOTS];        // for the eviction scores
+
+// distances are kept to 0.1 nm, as they are shown
+static inline uint16_t pack_dist(float d)
+{
+    if (d >= 6553.4f)
+        return 0xFFFF;
+    return (uint16_t) (d * 10.0f + 0.5f);
+}
+
+#if defined(COMPACT_TABLE)
+static uint32_t epoch = 0;
+
+// zero stays zero (never), anything before the epoch becomes 1
+static inline stamp_t to_stamp(uint32_t t)
+{
+    if (t == 0)
+        return 0;
+    if (t <= epoch)
+        return 1;
+    t -= epoch;
+    return (t > 0xFFFF ? 0xFFFF : t);
+}
+
+// - never later than now, even if the epoch moved while a stamp was made
+static inline uint32_t from_stamp(stamp_t s)
+{
+    if (s == 0)
+        return 0;
+    uint32_t t = epoch + s;
+    return (t > timenow ? timenow : t);
+}
+
+// baro altitudes are all multiples of 25 ft, GNSS heights (meters) are 12 bits
+static inline alt_t pack_alt(uint32_t alt, int alt_type)
+{
+    return (alt_t) (alt_type ? (int32_t) alt : (int32_t) alt / 25);
+}
+
+static inline uint32_t unpack_alt(alt_t a, int alt_type)
+{
+    return (uint32_t) (alt_type ? a : a * 25);
+}
+
+// the callsign characters are 6-bit codes to begin with - see parse.cpp
+static void pack_callsign(identity_t *ip, const char *cs)
+{
+    uint8_t *p = ip->callsign;
+    for (int j=0; j < 8; j += 4, p += 3) {
+        uint32_t v = ((cs[j] & 0x3F) << 18) | ((cs[j+1] & 0x3F) << 12)
+                   | ((cs[j+2] & 0x3F) << 6) | (cs[j+3] & 0x3F);
+        p[0] = v >> 16;
+        p[1] = v >> 8;
+        p[2] = v;
+    }
+    ip->has_callsign = (cs[0] != 0);
+}
+
+static void unpack_callsign(const identity_t *ip, char *cs)
+{
+    memset(cs, 0, 10);
+    if (! ip->has_callsign)
+        return;
+    const uint8_t *p = ip->callsign;
+    for (int j=0; j < 8; j += 4, p += 3) {
+        uint32_t v = (p[0] << 16) | (p[1] << 8) | p[2];
+        for (int n=0; n < 4; n++) {
+            int c = (v >> (18 - 6*n)) & 0x3F;
+            cs[j+n] = (c < 32 ? c + 0x40 : c);
+        }
+    }
+}
+
+static inline void store_frame(cpr_track_t *tp, int f, uint32_t lat, uint32_t lon, uint32_t ms)
+{
+    uint32_t t = (ms >> 7) & 0x7FFF;
+    if (t == 0 && ms != 0)      // zero is kept for no frame at all
+        t = 1;
+    if (f) {
+        tp->cprlat_o = lat;
+        tp->cprlon_o = lon;
+        tp->cprtime_o = t;
+    } else {
+        tp->cprlat_e = lat;
+        tp->cprlon_e = lon;
+        tp->cprtime_e = t;
+    }
+}
+#else
+#define to_stamp(t)         (t)
+#define from_stamp(s)       (s)
+#define pack_alt(alt, at)   (alt)
+#define unpack_alt(a, at)   (a)
+
+static inline void store_frame(cpr_track_t *tp, int f, uint32_t lat, uint32_t lon, uint32_t ms)
+{
+    tp->cprlat_eo[f] = lat;
+    tp->cprlon_eo[f] = lon;
+    tp->cprtime[f] = ms;
+}
+#endif
+
+// A hash table to quickly find IDs in container[]: open addressing with
+// linear probing, kept at most half full so that a probe sequence is short.
+// Zero means an empty slot, otherwise *base-1* index into container[].
+#define ACINDEX_SIZE (4*MAX_TRACKING_OBJECTS)
+static uint16_t acindex[ACINDEX_SIZE] = {0};
+
+// container[] is in two partitions: the first MAX_TRACKING_OBJECTS entries
+// for airborne traffic, the other MAX_GROUND_OBJECTS for traffic on the
+// ground, which only comes and goes in its own partition, expires sooner,
+// and is not a candidate for closest or for eviction.  An aircraft that takes
+// off or lands is moved to the other partition.  (Both are in the one
+// acindex[], so that any message finds an aircraft wherever it is.)
+static inline bool on_ground(int i)     // *base-1*
+{
+    return (i > MAX_TRACKING_OBJECTS);
+}
+
+// The empty entries in each partition are linked through their next
+// field, also *base-1*, zero at the end of the list.
+static uint16_t empties = 0;
+static uint16_t ground_empties = 0;
+
+// The airborne entries in two heaps kept up to date on every position update
+// and removal, see rank(): evict_heap by how expendable each one is, the top
+// one to be replaced by a new aircraft that scores better when the table is
+// full, and near_heap by distance, the closest being the one shown when
+// nothing else is.  Each is a binary heap with the largest key at the top,
+// the keys being the scores below or, for the closest, the complement of the
+// distance as in container[] (tenths of nm).  The keys are compared as
+// differences, see above(), so that they may wrap around.
+typedef struct {
+    uint16_t n;
+    uint32_t key[MAX_TRACKING_OBJECTS];
+    uint16_t item[MAX_TRACKING_OBJECTS];   // *base-0* index into container[]
+    uint16_t pos[MAX_TRACKING_OBJECTS];    // of each entry in item[], *base-1*, 0 if not in
+} heap_t;
+
+static heap_t evict_heap;   // all of the airborne entries
+static heap_t near_heap;    // those with a position shown, at some distance
+
+static inline bool above(uint32_t a, uint32_t b)
+{
+    return ((int32_t) (a - b) > 0);
+}
+
+static void heap_up(heap_t *h, int p)
+{
+    uint32_t key = h->key[p];
+    uint16_t item = h->item[p];
+    while (p > 0) {
+        int q = (p-1) >> 1;
+        if (! above(key, h->key[q]))
+            break;
+        h->key[p] = h->key[q];
+        h->item[p] = h->item[q];
+        h->pos[h->item[p]] = p+1;
+        p = q;
+    }
+    h->key[p] = key;
+    h->item[p] = item;
+    h->pos[item] = p+1;
+}
+
+static void heap_down(heap_t *h, int p)
+{
+    uint32_t key = h->key[p];
+    uint16_t item = h->item[p];
+    int n = h->n;
+    for (;;) {
+        int q = 2*p + 1;
+        if (q >= n)
+            break;
+        if (q+1 < n && above(h->key[q+1], h->key[q]))
+            q++;
+        if (! above(h->key[q], key))
+            break;
+        h->key[p] = h->key[q];
+        h->item[p] = h->item[q];
+        h->pos[h->item[p]] = p+1;
+        p = q;
+    }
+    h->key[p] = key;
+    h->item[p] = item;
+    h->pos[item] = p+1;
+}
+
+// put entry k into the heap with this key, or move it for its new key
+static void heap_set(heap_t *h, int k, uint32_t key)
+{
+    int p = h->pos[k];
+    if (p == 0) {
+        p = h->n++;
+        h->key[p] = key;
+        h->item[p] = k;
+        heap_up(h, p);
+        return;
+    }
+    --p;
+    uint32_t old = h->key[p];
+    h->key[p] = key;
+    if (above(key, old))
+        heap_up(h, p);
+    else if (above(old, key))
+        heap_down(h, p);
+}
+
+static void heap_remove(heap_t *h, int k)
+{
+    int p = h->pos[k];
+    if (p == 0)
+        return;
+    --p;
+    h->pos[k] = 0;
+    int last = --h->n;
+    if (p == last)
+        return;
+    uint32_t old = h->key[p];
+    h->key[p] = h->key[last];
+    h->item[p] = h->item[last];
+    h->pos[h->item[p]] = p+1;
+    if (above(h->key[p], old))
+        heap_up(h, p);
+    else
+        heap_down(h, p);
+}
+
+// How many positions have been heard from each aircraft, since when - the
+// count is halved now and then, so that it is the recent rate that matters.
+#define RATE_HALVING 64
+
+static inline void count_heard(int k)
+{
+    rate_t *rp = &rates[k];
+    if (rp->heard == 0) {
+        rp->firsttime = to_stamp(timenow);
+    } else if (rp->heard >= RATE_HALVING) {
+        uint32_t first = from_stamp(rp->firsttime);
+        rp->firsttime = to_stamp(first + (timenow - first) / 2);
+        rp->heard /= 2;
+    }
+    ++rp->heard;
+}
+
+// positions per 10 seconds, counting the first 10 seconds as a whole
+static inline int rate10(int k)
+{
+    const rate_t *rp = &rates[k];
+    uint32_t life = timenow - from_stamp(rp->firsttime);
+    if (life < 10)
+        life = 10;
+    return (10 * rp->heard) / life;
+}
+
+// What the score of an aircraft is made of.  The scorer that settings->evict
+// selects (EVD, EVP) sets the terms it uses, indexed by the EVICT_ reasons,
+// and the score is their sum, the larger the more expendable, in tenths of
+// nm like the distance.  The terms that would grow as time goes by (the age)
+// are instead minus the time of the last position - all of the scores would
+// have grown alike - so that a score only changes when its entry is updated.
+typedef struct {
+    uint16_t distance;        // tenths of nm
+    int32_t  altitude;        // feet, 0 if not known
+    uint32_t heardtime;       // timenow of the last position
+    uint8_t  aircraft_type;
+    uint8_t  rate10;          // see rate10()
+    bool     followed;        // settings->follow
+} candidate_t;
+
+typedef void (*scorer_t)(const candidate_t *cp, uint32_t *terms);
+
+// the farthest is the most expendable - as it was before EVP
+static void score_by_distance(const candidate_t *cp, uint32_t *terms)
+{
+    terms[EVICT_DIST] = cp->distance;
+}
+
+#define ALT_FEET      50      // of separation from settings->ownalt, per 0.1 nm
+#define RATE_WEIGHT    5      // per position per 10 seconds,
+#define RATE_MAX      20      //   up to this many
+#define AGE_WEIGHT     2      // per second since the last position
+
+// what each aircraft type is worth, in tenths of nm - the small and slow
+// ones that are hard to see, and those that are not yet known, are kept
+// over airliners at the same distance
+static const uint16_t type_weight[16] = {
+    100,    // unknown
+    300, 300, 300, 300,     // glider, LTA, parachute, hang glider
+    0, 300, 0, 0,           // reserved, UAV, spacecraft, not used
+    300, 100, 0, 0,         // light, medium 1, medium 2, high vortex
+    0, 0, 300               // heavy, high performance, rotorcraft
+};
+
+// the closest and nearest in altitude, heard often and recently, go last -
+// a new aircraft has been heard once, and needs to be somewhat closer than
+// one that has been tracked for a while to replace it
+static void score_by_priority(const candidate_t *cp, uint32_t *terms)
+{
+    terms[EVICT_DIST] = cp->distance;
+    if (settings->ownalt != NO_OWNALT && cp->altitude != 0)
+        terms[EVICT_ALT] = abs(cp->altitude - 100 * (int32_t) settings->ownalt) / ALT_FEET;
+    terms[EVICT_RATE] = 0 - RATE_WEIGHT * (cp->rate10 < RATE_MAX ? cp->rate10 : RATE_MAX);
+    terms[EVICT_AGE] = 0 - AGE_WEIGHT * cp->heardtime;
+    terms[EVICT_TYPE] = 0 - type_weight[cp->aircraft_type & 0x0F];
+}
+
+static const scorer_t scorers[] = {
+    score_by_distance,      // EVICTDIST
+    score_by_priority       // EVICTPRIO
+};
+
+#define FOLLOWED_WEIGHT (1 << 24)       // more than all of the rest together
+
+static uint32_t score(const candidate_t *cp, uint32_t *terms)
+{
+    for (int r=0; r < EVICT_REASONS; r++)
+        terms[r] = 0;
+    int policy = settings->evict;
+    if (policy >= (int) (sizeof(scorers) / sizeof(scorers[0])))
+        policy = EVICTPRIO;
+    (*scorers[policy])(cp, terms);
+    uint32_t key = 0;
+    for (int r=0; r < EVICT_REASONS; r++)
+        key += terms[r];
+    if (cp->followed)
+        key -= FOLLOWED_WEIGHT;
+    return key;
+}
+
+// an entry in the table as a candidate - if not shown, as if about to expire
+static void get_candidate(int k, candidate_t *cp)
+{
+    const slot_t *sp = &container[k];
+    cp->distance = sp->distance;
+    cp->altitude = unpack_alt(altitudes[k], alt_types[k]);
+    cp->heardtime = (sp->positiontime != 0 ? from_stamp(sp->positiontime)
+                                           : timenow - ENTRY_EXPIRATION_TIME);
+    cp->aircraft_type = identities[k].aircraft_type;
+    cp->rate10 = rate10(k);
+    cp->followed = (settings->follow != 0 && sp->addr == settings->follow);
+}
+
+// re-key entry k after its position, positiontime or aircraft type changed
+static void rank(int k)
+{
+    if (k >= MAX_TRACKING_OBJECTS)     // on the ground
+        return;
+    const slot_t *sp = &container[k];
+    candidate_t c;
+    uint32_t terms[EVICT_REASONS];
+    get_candidate(k, &c);
+    heap_set(&evict_heap, k, score(&c, terms));
+    if (sp->positiontime != 0 && sp->distance > 0)
+        heap_set(&near_heap, k, 0xFFFF - sp->distance);
+    else
+        heap_remove(&near_heap, k);
+}
+
+// re-score all of the airborne entries, after a change of the settings the
+// scores depend on - EVD/EVP, OWN, TRK - so that they are all alike again
+// (the closest are not affected)
+void traffic_rerank()
+{
+    candidate_t c;
+    uint32_t terms[EVICT_REASONS];
+    for (int k=0; k < MAX_TRACKING_OBJECTS; k++) {
+        if (evict_heap.pos[k] == 0)
+            continue;
+        get_candidate(k, &c);
+        heap_set(&evict_heap, k, score(&c, terms));
+    }
+}
+
+static void unrank(int k)
+{
+    if (k >= MAX_TRACKING_OBJECTS)
+        return;
+    heap_remove(&evict_heap, k);
+    heap_remove(&near_heap, k);
+}
+
+// the entry that is to make room for this new aircraft, *base-1* - or 0 if it
+// scores no better than the most expendable one in the table, the top of
+// evict_heap (never the followed aircraft, unless it is the only one)
+// - the scores are compared as they are now, and why is counted, by the term
+//   that made the most difference
+static int find_expendable(const candidate_t *cp)
+{
+    if (evict_heap.n == 0)
+        return 0;
+    int e = evict_heap.item[0] + 1;
+    candidate_t v;
+    uint32_t vterms[EVICT_REASONS], cterms[EVICT_REASONS];
+    get_candidate(e-1, &v);
+    bool evict = above(score(&v, vterms), score(cp, cterms));
+    int reason = EVICT_DIST;
+    int32_t most = INT32_MIN;
+    for (int r=EVICT_DIST; r < EVICT_REASONS; r++) {
+        int32_t d = (int32_t) (evict ? vterms[r] - cterms[r] : cterms[r] - vterms[r]);
+        if (d > most) {
+            most = d;
+            reason = r;
+        }
+    }
+    if (! evict) {
+        ++rejected_by_reason[reason];
+        return 0;
+    }
+    ++evicted_by_reason[reason];
+if(settings->debug>1)
+Serial.printf("evicting ID %06X for %06X\n", container[e-1].addr, fo.addr);
+    return e;
+}
+
+// The entries are expired by a timing wheel: each one is in the bucket for
+// the second it is due to expire unless heard from again, see schedule(),
+// and traffic_loop() only looks at the one bucket for each second.  An
+// airborne entry that is due is not removed yet but kept, in a list in the
+// order they went quiet, as long as there is room in the table - either
+// until it has been quiet for STALE_EXPIRATION_TIME, or until its entry is
+// needed for another aircraft, see reclaim_stale().
+//
+// The buckets and that list are circular doubly linked lists, through
+// tnext[] and tprev[] - *base-0* indices, the entries' own first, then a
+// head for each list.  An entry that is in no list points to itself.
+#define WHEEL_SIZE 32      // seconds, a power of 2, above ENTRY_EXPIRATION_TIME
+#define STALE_EXPIRATION_TIME (ENTRY_EXPIRATION_TIME << 5)
+#define WHEEL_HEAD(b)  (TRAFFIC_SLOTS + (b))
+#define STALE_HEAD     (TRAFFIC_SLOTS + WHEEL_SIZE)
+#define DUE_HEAD       (TRAFFIC_SLOTS + WHEEL_SIZE + 1)   // the bucket being expired
+#define TIMER_NODES    (TRAFFIC_SLOTS + WHEEL_SIZE + 2)
+
+static uint16_t tnext[TIMER_NODES];
+static uint16_t tprev[TIMER_NODES];
+static uint32_t wheel_time = 0;     // the last second expired
+
+static inline void timer_unlink(int k)
+{
+    tnext[tprev[k]] = tnext[k];
+    tprev[tnext[k]] = tprev[k];
+    tnext[k] = k;
+    tprev[k] = k;
+}
+
+// at the end of list h
+static inline void timer_link(int h, int k)
+{
+    timer_unlink(k);
+    int t = tprev[h];
+    tnext[t] = k;
+    tprev[k] = t;
+    tnext[k] = h;
+    tprev[h] = k;
+}
+
+static inline uint32_t expiration_time(int k)
+{
+    return (k >= MAX_TRACKING_OBJECTS ? GROUND_EXPIRATION_TIME : ENTRY_EXPIRATION_TIME);
+}
+
+// into the bucket for the second entry k will be due, after its positiontime
+// - which is at most ENTRY_EXPIRATION_TIME+1 seconds away, within the wheel
+static void schedule(int k)
+{
+    uint32_t t = from_stamp(container[k].positiontime) + expiration_time(k) + 1;
+    if (t <= wheel_time)
+        t = wheel_time + 1;
+    timer_link(WHEEL_HEAD(t & (WHEEL_SIZE-1)), k);
+}
+
+#if defined(THREADED)
+// A sequence count per entry in the table, odd while the receive task is
+// writing into that entry, so that the output task can take a consistent
+// copy of it (a "seqlock").  Only the receive task writes into the table.
+static uint32_t seq[TRAFFIC_SLOTS] = {0};
+
+static inline void write_begin(int k)
+{
+    __atomic_store_n(&seq[k], seq[k]+1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+static inline void write_end(int k)
+{
+    __atomic_store_n(&seq[k], seq[k]+1, __ATOMIC_RELEASE);
+}
+#else
+#define write_begin(k)
+#define write_end(k)
+#endif
+
+// put together entry k of the table, as a whole
+static void gather(int k, ufo_t *fop)
+{
+    const slot_t *sp = &container[k];
+    const cpr_track_t *tp = &tracks[k];
+    const velocity_t *vp = &velocities[k];
+    const identity_t *ip = &identities[k];
+    const commb_t *cp = &commbs[k];
+    fop->addr = sp->addr;
+    fop->positiontime = from_stamp(sp->positiontime);
+    fop->distance = sp->distance * 0.1f;
+    fop->bearing = sp->bearing;
+    fop->next = sp->next;
+    fop->altitude = unpack_alt(altitudes[k], alt_types[k]);
+    fop->alt_type = alt_types[k];
+    fop->latitude = tp->latitude;
+    fop->longitude = tp->longitude;
+    fop->cprflags = tp->cprflags;
+#if defined(COMPACT_TABLE)
+    uint32_t ms = millis();
+#endif
+    for (int f=0; f < 2; f++) {
+        fop->cprlat_eo[f] = cpr_lat(tp, f);
+        fop->cprlon_eo[f] = cpr_lon(tp, f);
+#if defined(COMPACT_TABLE)
+        uint32_t age = cpr_age(tp, f, ms);
+        fop->cprtime[f] = (age == 0xFFFFFFFF ? 0 : ms - age);
+#else
+        fop->cprtime[f] = tp->cprtime[f];
+#endif
+    }
+    fop->velocitytime = from_stamp(vp->velocitytime);
+    fop->ewv = vp->ewv;
+    fop->nsv = vp->nsv;
+    fop->groundspeed = vp->groundspeed;
+    fop->track = vp->track;
+    fop->track_is_valid = vp->track_is_valid;
+    fop->heading_is_valid = vp->heading_is_valid;
+    fop->heading = vp->heading;
+    fop->airspeed = vp->airspeed;
+    fop->airspeed_type = vp->airspeed_type;
+    fop->vert_rate_source = vp->vert_rate_source;
+    fop->vert_rate = vp->vert_rate;
+    fop->alt_diff = vp->alt_diff;
+#if defined(COMPACT_TABLE)
+    unpack_callsign(ip, fop->callsign);
+    fop->rssi = 0;
+#else
+    memcpy(fop->callsign, ip->callsign, sizeof(fop->callsign));
+    fop->rssi = ip->rssi;
+#endif
+    fop->aircraft_type = ip->aircraft_type;
+    fop->commbtime = from_stamp(cp->commbtime);
+    fop->sel_alt = cp->sel_alt;
+    fop->roll = cp->roll;
+    fop->tas = cp->tas;
+    fop->ias = cp->ias;
+    fop->mach = cp->mach;
+    fop->mag_heading = cp->mag_heading;
+    fop->commb_fields = cp->commb_fields;
+}
+
+// and take it apart again, into entry k
+static void scatter(int k, const ufo_t *fop)
+{
+    slot_t *sp = &container[k];
+    cpr_track_t *tp = &tracks[k];
+    velocity_t *vp = &velocities[k];
+    identity_t *ip = &identities[k];
+    commb_t *cp = &commbs[k];
+    sp->addr = fop->addr;
+    sp->positiontime = to_stamp(fop->positiontime);
+    sp->distance = pack_dist(fop->distance);
+    sp->bearing = fop->bearing;
+    sp->next = fop->next;
+    altitudes[k] = pack_alt(fop->altitude, fop->alt_type);
+    alt_types[k] = fop->alt_type;
+    tp->latitude = fop->latitude;
+    tp->longitude = fop->longitude;
+    tp->cprflags = fop->cprflags;
+    for (int f=0; f < 2; f++)
+        store_frame(tp, f, fop->cprlat_eo[f], fop->cprlon_eo[f], fop->cprtime[f]);
+    vp->velocitytime = to_stamp(fop->velocitytime);
+    vp->ewv = fop->ewv;
+    vp->nsv = fop->nsv;
+    vp->groundspeed = fop->groundspeed;
+    vp->track = fop->track;
+    vp->track_is_valid = fop->track_is_valid;
+    vp->heading_is_valid = fop->heading_is_valid;
+    vp->heading = fop->heading;
+    vp->airspeed = fop->airspeed;
+    vp->airspeed_type = fop->airspeed_type;
+    vp->vert_rate_source = fop->vert_rate_source;
+    vp->vert_rate = fop->vert_rate;
+    vp->alt_diff = fop->alt_diff;
+#if defined(COMPACT_TABLE)
+    pack_callsign(ip, fop->callsign);
+#else
+    memcpy(ip->callsign, fop->callsign, sizeof(ip->callsign));
+    ip->rssi = fop->rssi;
+#endif
+    ip->aircraft_type = fop->aircraft_type;
+    cp->commbtime = to_stamp(fop->commbtime);
+    cp->sel_alt = fop->sel_alt;
+    cp->roll = fop->roll;
+    cp->tas = fop->tas;
+    cp->ias = fop->ias;
+    cp->mach = fop->mach;
+    cp->mag_heading = fop->mag_heading;
+    cp->commb_fields = fop->commb_fields;
+}
+
+// all zeros, as for an empty entry
+static void clear_entry(int k)
+{
+    memset(&container[k], 0, sizeof(container[k]));
+    memset(&tracks[k], 0, sizeof(tracks[k]));
+    altitudes[k] = 0;
+    alt_types[k] = 0;
+    memset(&velocities[k], 0, sizeof(velocities[k]));
+    memset(&identities[k], 0, sizeof(identities[k]));
+    memset(&commbs[k], 0, sizeof(commbs[k]));
+    memset(&rates[k], 0, sizeof(rates[k]));
+}
 
+// copy entry k as it is between updates
+void traffic_snapshot(int k, ufo_t *fop)
+{
+#if defined(THREADED)
+    uint32_t s1, s2;
+    do {
+        s1 = __atomic_load_n(&seq[k], __ATOMIC_ACQUIRE);
+        gather(k, fop);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        s2 = __atomic_load_n(&seq[k], __ATOMIC_RELAXED);
+    } while ((s1 & 1) || s1 != s2);
+#else
+    gather(k, fop);
+#endif
+}
+
+// single hot fields of entry k, for a quick look before taking a snapshot
+uint32_t traffic_addr(int k)
+{
+    return __atomic_load_n(&container[k].addr, __ATOMIC_RELAXED);
+}
+
+uint32_t traffic_positiontime(int k)
+{
+    return from_stamp(__atomic_load_n(&container[k].positiontime, __ATOMIC_RELAXED));
+}
+
+// the parts of entry k that the decoding uses - only for the receive task,
+// which is the one that writes them
+const cpr_track_t *traffic_cpr(int k)
+{
+    return &tracks[k];
+}
+
+const velocity_t *traffic_velocity(int k)
+{
+    return &velocities[k];
+}
+
+// - may be called from the output side, while the receive task is moving
+//   things around in the heap, but any item in it is a valid index
 int find_closest_traffic()
 {
-    if (closest.addr)
-        return closest.index1;
+    if (__atomic_load_n(&near_heap.n, __ATOMIC_RELAXED) != 0)
+        return __atomic_load_n(&near_heap.item[0], __ATOMIC_RELAXED) + 1;
     return 0;    // not found
 }
 
+// the home slot in acindex[] for an ID - the low bits of ICAO IDs are not
+//   random enough by themselves, so mix them all in (Fibonacci hashing)
+static inline int achash(uint32_t addr)
+{
+    return ((addr * 2654435769u) >> 16) & (ACINDEX_SIZE-1);
+}
+
 int find_traffic_by_addr(uint32_t addr)
 {
-    int a = (addr & 0x0000FF);
-    int i = acindex[a];
-    while (i != 0) {
+    if (addr == 0)
+        return 0;
+    for (int h = achash(addr); ; h = (h+1) & (ACINDEX_SIZE-1)) {
+        int i = acindex[h];
+        if (i == 0)
+            break;
         if (container[i-1].addr == addr)
             return i;
-        i = container[i-1].next;
     }
     return 0;    // not found
 }
 
-static int find_empty()
+static int find_empty(bool ground)
 {
-    int i = find_traffic_by_addr(0);
+    if (ground)
+        return ground_empties;
+    int i = empties;
     if (i == 0)
         num_tracked = MAX_TRACKING_OBJECTS;   // empty slot not found
     return i;
@@ -59,70 +787,167 @@ static int find_empty()
 static void insert_traffic_by_index(int i, uint32_t addr)
 {
     int k = i-1;
-    int a = (addr & 0x0000FF);
-    int j = acindex[a];
-    acindex[a] = i;
-    if (addr == 0) {                 // creating an empty slot
-        if (container[k].addr == farthest.addr) {
-            farthest.dist = 0;
-            farthest.addr = 0;
-            farthest.index1 = 0;
-        }
-        if (container[k].addr == closest.addr) {
-            closest.dist = 9999.9;
-            closest.addr = 0;
-            closest.index1 = 0;
-        }
+    int j = 0;
+    if (addr == 0 && on_ground(i)) {
+        j = ground_empties;
+        ground_empties = i;
+        if (container[k].addr != 0 && num_ground > 0)
+            --num_ground;
+    } else if (addr == 0) {          // creating an empty slot
+        j = empties;
+        empties = i;
         if (num_tracked > 0)
             --num_tracked;
 if(settings->debug>1)
 Serial.printf("deleted ID %06X at index0 %d\n", addr, k);
+    } else {
+        int h = achash(addr);
+        while (acindex[h] != 0)
+            h = (h+1) & (ACINDEX_SIZE-1);
+        acindex[h] = i;
     }
-    if (container[k].addr == 0) {    // filling an empty slot
+    if (container[k].addr == 0 && on_ground(i)) {
+        if (addr != 0)
+            ++num_ground;
+    } else if (container[k].addr == 0) {    // filling an empty slot
         if (num_tracked < MAX_TRACKING_OBJECTS)
             ++num_tracked;
 if(settings->debug>1)
 Serial.printf("inserted ID %06X at index0 %d\n", addr, k);
     }
-    container[k] = EmptyFO;    // all zeros before writing in new data
-    // implies container[i].timestamp = 0;   // until we get a position report
+    unrank(k);                 // until it has a distance
+    write_begin(k);
+    clear_entry(k);            // all zeros before writing in new data
+    // implies positiontime = 0;   // until we get a position report
     container[k].addr = addr;
     container[k].next = j;
+    write_end(k);
+    if (addr == 0)
+        timer_unlink(k);
+    else
+        schedule(k);           // (again when a position comes in)
 }
 
 // de-link traffic that is about to be erased from container[i-1]
 static void delink_traffic_by_index(int i)
 {
-    int a = ((container[i-1].addr) & 0x0000FF);
-    int j = acindex[a];
-    if (j == i) {                           // at head of list
-        acindex[a] = container[i-1].next;   // zero if no next
-        return;
-    }
-    while (j != 0) {
-        int k = j;
-        j = container[j-1].next;
-        if (j == i) {
-            container[k-1].next = container[i-1].next;
+    uint32_t addr = container[i-1].addr;
+    if (addr == 0) {                        // an empty slot
+        uint16_t *list = (on_ground(i) ? &ground_empties : &empties);
+        if (*list == i) {                   // at head of list, as from find_empty()
+            *list = container[i-1].next;
             return;
         }
+        for (int j = *list; j != 0; j = container[j-1].next) {
+            if (container[j-1].next == i) {
+                container[j-1].next = container[i-1].next;
+                return;
+            }
+        }
+        return;
     }
-    // if not found (should not happen) then nothing is done
+    int h = achash(addr);
+    while (acindex[h] != i) {
+        if (acindex[h] == 0)
+            return;     // if not found (should not happen) then nothing is done
+        h = (h+1) & (ACINDEX_SIZE-1);
+    }
+    // Close the gap by moving back any later entry in the same run of
+    //   occupied slots whose home slot is not between the gap and itself,
+    //   so that no tombstones are needed
+    for (int j = h; ; ) {
+        acindex[h] = 0;
+        int home;
+        do {
+            j = (j+1) & (ACINDEX_SIZE-1);
+            if (acindex[j] == 0)
+                return;
+            home = achash(container[acindex[j]-1].addr);
+        } while (((j - home) & (ACINDEX_SIZE-1)) < ((j - h) & (ACINDEX_SIZE-1)));
+        acindex[h] = acindex[j];
+        h = j;
+    }
+}
+
+// move the entry in container[i-1] into the empty one in container[j-1]
+static void move_traffic(int i, int j)
+{
+    ufo_t f;
+    gather(i-1, &f);
+    delink_traffic_by_index(i);
+    insert_traffic_by_index(i, 0);
+    delink_traffic_by_index(j);
+    insert_traffic_by_index(j, f.addr);
+    f.next = 0;
+    f.cprflags &= CPR_FIX;     // the frames kept are of the other kind
+    write_begin(j-1);
+    scatter(j-1, &f);
+    write_end(j-1);
+    rank(j-1);
+    schedule(j-1);
+    ++ground_moves[on_ground(j) ? 0 : 1];
+if(settings->debug>1)
+Serial.printf("moved ID %06X from index0 %d to %d\n", f.addr, i-1, j-1);
+}
+
+// empty the entry in container[i-1]
+static void expire_traffic(int i)
+{
+    delink_traffic_by_index(i);
+    insert_traffic_by_index(i, 0);      // link into the empty (0-address) list
 }
 
-// find existing entry or create a new one
-static int add_traffic_by_addr(uint32_t addr, float distance)
+// the entry of the aircraft that has been quiet the longest, emptied for
+// another one, *base-1* - or 0 if there is none
+static int reclaim_stale()
 {
+    int k = tnext[STALE_HEAD];
+    if (k == STALE_HEAD)
+        return 0;
+    expire_traffic(k+1);
+    ++evicted_by_reason[EVICT_QUIET];
+    return find_empty(false);
+}
+
+// find existing entry or create a new one, in the partition for traffic
+// on the ground or in the air
+static int add_traffic_by_addr(uint32_t addr, float distance, bool ground)
+{
+    candidate_t c;
     // find if already in container[]
     int j = find_traffic_by_addr(addr);
     if (j != 0) {
 //if(settings->debug>1)
 //Serial.println("add_traffic_by_addr(): already in table");
+        if (on_ground(j) == ground)
+            return j;
+        // landed or took off - move it over if there is room, else leave it
+        int e = find_empty(ground);
+        if (e == 0 && ! ground)
+            e = reclaim_stale();
+        if (e != 0) {
+            move_traffic(j, e);
+            return e;
+        }
+        if (ground)
+            return j;
+        get_candidate(j-1, &c);
+        c.distance = pack_dist(distance);
+        c.heardtime = timenow;
+        e = find_expendable(&c);
+        if (e != 0) {
+            delink_traffic_by_index(e);
+            insert_traffic_by_index(e, 0);
+            move_traffic(j, e);
+            return e;
+        }
         return j;
     }
 
-    // else replace an empty object, if any
-    j = find_empty();
+    // else replace an empty object, if any, or one kept while there was room
+    j = find_empty(ground);
+    if (j == 0 && ! ground)
+        j = reclaim_stale();
     if (j != 0) {
         delink_traffic_by_index(j);
         insert_traffic_by_index(j, addr);
@@ -131,13 +956,21 @@ Serial.println("add_traffic_by_addr(): replaced empty entry in table");
         return (j);
     }
 
-    // else replace farthest (non-followed) object if found
-    //   (avoids doing linear search)
-    if (distance < farthest.dist) {
-        j = farthest.index1;
-        farthest.dist = 0;       // will be slowly changed in traffic_update()
-        farthest.addr = 0;
-        farthest.index1 = 0;
+    // the ground traffic only ever replaces expired ground traffic
+    if (ground) {
+        ++ground_full;
+        return 0;
+    }
+
+    // else replace the most expendable object, if this one scores better
+    c.distance = pack_dist(distance);
+    c.altitude = fo.altitude;
+    c.heardtime = timenow;
+    c.aircraft_type = 0;        // until an identity message
+    c.rate10 = 1;               // heard once, see rate10()
+    c.followed = (settings->follow != 0 && addr == settings->follow);
+    j = find_expendable(&c);
+    if (j != 0) {
         delink_traffic_by_index(j);
         insert_traffic_by_index(j, addr);
         return (j);
@@ -157,50 +990,169 @@ void update_traffic_identity()
     int i = find_traffic_by_addr(fo.addr);
     if (i == 0)
         return;
-    ufo_t *fop = &container[i-1];
+    identity_t *ip = &identities[i-1];
     int aircraft_type = fo.aircraft_type;
     ++msg_by_aircraft_type[aircraft_type];
-    if (fop->aircraft_type == 0)
+    if (ip->aircraft_type == 0)
         ++new_by_aircraft_type[aircraft_type];
-    fop->aircraft_type = aircraft_type;
-    memcpy(fop->callsign, fo.callsign, 8);
+    bool rescore = (ip->aircraft_type != aircraft_type);
+    write_begin(i-1);
+    ip->aircraft_type = aircraft_type;
+#if defined(COMPACT_TABLE)
+    pack_callsign(ip, fo.callsign);
+#else
+    memcpy(ip->callsign, fo.callsign, 8);
+#endif
+    write_end(i-1);
+    if (rescore)
+        rank(i-1);
 }
 
-void update_traffic_position()
+#if defined(TESTING)
+// the approximations that went into what was just written into entry k
+static void check_velocity(int k)
 {
-    // find in table, or try and create a new entry
-    int i = add_traffic_by_addr(fo.addr, fo.distance);
-    if (i == 0)
-        return;
-    ufo_t *fop = &container[i-1];
-    if (fop->latitude == 0 && fop->altitude != 0) {
-if(settings->debug>1)
-Serial.printf("ADS-B overwriting Mode S altitude for ID %06X\n", fo.addr);
+    const velocity_t *vp = &velocities[k];
+    float fgroundspeed = approxHypotenuse( (float)vp->nsv, (float)vp->ewv );
+    if ((float)vp->groundspeed > 1.05 * fgroundspeed)
+        ++upd_by_gs_incorrect[1];
+    else if ((float)vp->groundspeed < 0.95 * fgroundspeed)
+        ++upd_by_gs_incorrect[1];
+    else
+        ++upd_by_gs_incorrect[0];
+    float ftrack = atan2_approx((float)vp->nsv, (float)vp->ewv);
+    if (ftrack < 0)
+        ftrack += 360;
+    if (ftrack > 270 && vp->track < 90)
+        ftrack -= 360;
+    else if (ftrack < 90 && vp->track > 270)
+        ftrack += 360;
+    if (vp->groundspeed>0 && fabs(ftrack-vp->track) > 3)
+        ++upd_by_trk_incorrect[1];
+    else
+        ++upd_by_trk_incorrect[0];
+}
+
+static void check_position(int k)
+{
+    const slot_t *sp = &container[k];
+    float x, y;
+    const cprref_t *ref = cpr_reference();
+    y = (111300.0 * 0.00053996) * (tracks[k].latitude - ref->reflat); /* nm */
+    x = (111300.0 * 0.00053996) * (tracks[k].longitude - ref->reflon) * CosLat(ref->reflat);
+    float fdistance = approxHypotenuse(x, y);
+    float distance = sp->distance * 0.1f;       // (rounded to 0.05 nm either way)
+    if (distance > 1.02 * fdistance + 0.05)
+        ++upd_by_dist_incorrect[1];
+    else if (distance < 0.98 * fdistance - 0.05)
+        ++upd_by_dist_incorrect[1];
+    else
+        ++upd_by_dist_incorrect[0];
+    int16_t fbearing = (int16_t) atan2_approx(y, x);     /* degrees from ref to target */
+    if (fbearing < 0)
+        fbearing += 360;
+    if (abs(sp->bearing - fbearing) > 2)
+        ++upd_by_brg_incorrect[1];
+    else
+        ++upd_by_brg_incorrect[0];
+}
+#endif
+
+// forget the CPR frames that are too old to be used, before their 15-bit
+// times wrap around to look recent again - see cpr_age()
+static void cpr_expire(cpr_track_t *tp)
+{
+#if defined(COMPACT_TABLE)
+    uint32_t ms = millis();
+    for (int f=0; f < 2; f++) {
+        uint32_t age = cpr_age(tp, f, ms);
+        if (age != 0xFFFFFFFF && age > CPR_LOCAL_MS)
+            store_frame(tp, f, 0, 0, 0);
     }
-    fop->latitude  = fo.latitude;
-    fop->longitude = fo.longitude;
-    fop->alt_type  = fo.alt_type;
-    fop->altitude  = fo.altitude;
-    fop->distance  = fo.distance;
-    fop->bearing   = fo.bearing;
+#endif
+}
+
+// the position and the CPR frame it came in, common to both kinds
+static void update_position(int k)
+{
+    slot_t *sp = &container[k];
+    cpr_track_t *tp = &tracks[k];
+    tp->latitude  = fo.latitude;
+    tp->longitude = fo.longitude;
+    sp->distance  = pack_dist(fo.distance);
+    sp->bearing   = fo.bearing;
+    // keep this frame, for decoding the next ones - see decodeCPR()
+    int f = mm.fflag;
+    cpr_expire(tp);
+    store_frame(tp, f, mm.cprlat, mm.cprlon, millis());
+    tp->cprflags = (tp->cprflags & (CPR_EVEN|CPR_ODD)) | (f ? CPR_ODD : CPR_EVEN) | fo.cprflags;
+    count_heard(k);
+    int aircraft_type = identities[k].aircraft_type;
+    stamp_t now = to_stamp(timenow);
     if (settings->ac_type != 0) {
         // filtering by aircraft_type, wait until got identity message
-        //   - until then, fop->aircraft_type is 0
-        fop->positiontime = 0;      // signals do-not-display, filtered out
+        //   - until then, aircraft_type is 0
+        sp->positiontime = 0;       // signals do-not-display, filtered out
         if (settings->ac_type == 254) {
             // only show medium & heavy
-            if (fop->aircraft_type != 0 && (fop->aircraft_type >= 10 || fop->aircraft_type <= 13))
-                fop->positiontime = timenow;
+            if (aircraft_type != 0 && (aircraft_type >= 10 || aircraft_type <= 13))
+                sp->positiontime = now;
         } else if (settings->ac_type == 255) {
             // exclude medium & heavy
-            if (fop->aircraft_type != 0 && (fop->aircraft_type < 10 || fop->aircraft_type > 13))
-                fop->positiontime = timenow;
-        } else if (fop->aircraft_type == settings->ac_type) {
-            fop->positiontime = timenow;
+            if (aircraft_type != 0 && (aircraft_type < 10 || aircraft_type > 13))
+                sp->positiontime = now;
+        } else if (aircraft_type == settings->ac_type) {
+            sp->positiontime = now;
         }
     } else {
-        fop->positiontime = timenow;
+        sp->positiontime = now;
+    }
+    rank(k);
+    schedule(k);
+}
+
+void update_traffic_position()
+{
+    // find in table, or try and create a new entry
+    int i = add_traffic_by_addr(fo.addr, fo.distance, false);
+    if (i == 0)
+        return;
+    int k = i-1;
+    if (tracks[k].latitude == 0 && altitudes[k] != 0) {
+if(settings->debug>1)
+Serial.printf("ADS-B overwriting Mode S altitude for ID %06X\n", fo.addr);
     }
+    write_begin(k);
+    alt_types[k] = fo.alt_type;
+    altitudes[k] = pack_alt(fo.altitude, fo.alt_type);
+    update_position(k);
+    write_end(k);
+#if defined(TESTING)
+    check_position(k);
+#endif
+}
+
+// surface position messages - position, groundspeed & track, no altitude
+void update_traffic_surface()
+{
+    int i = add_traffic_by_addr(fo.addr, fo.distance, true);
+    if (i == 0)
+        return;
+    int k = i-1;
+    velocity_t *vp = &velocities[k];
+    write_begin(k);
+    alt_types[k] = 0;
+    altitudes[k] = 0;
+    vp->ewv = fo.ewv;
+    vp->nsv = fo.nsv;
+    vp->groundspeed = fo.groundspeed;
+    vp->track_is_valid = fo.track_is_valid;
+    if (fo.track_is_valid)
+        vp->track = fo.track;
+    vp->vert_rate = 0;
+    vp->velocitytime = to_stamp(timenow);
+    update_position(k);
+    write_end(k);
 }
 
 void update_traffic_velocity()
@@ -209,163 +1161,200 @@ void update_traffic_velocity()
     int i = find_traffic_by_addr(fo.addr);
     if (i == 0)
         return;
-    ufo_t *fop = &container[i-1];
-    fop->ewv = fo.ewv;
-    fop->nsv = fo.nsv;
-    fop->groundspeed = fo.groundspeed;
-    fop->track_is_valid = fo.track_is_valid;
-    fop->track = fo.track;
-    fop->airspeed_type = fo.airspeed_type;
-    fop->airspeed = fo.airspeed;
-    fop->heading_is_valid = fo.heading_is_valid;
-    fop->heading = fo.heading;
-    fop->vert_rate = fo.vert_rate;
-    fop->alt_diff = fo.alt_diff;
-    fop->velocitytime = timenow;
+    velocity_t *vp = &velocities[i-1];
+    write_begin(i-1);
+    vp->ewv = fo.ewv;
+    vp->nsv = fo.nsv;
+    vp->groundspeed = fo.groundspeed;
+    vp->track_is_valid = fo.track_is_valid;
+    vp->track = fo.track;
+    vp->airspeed_type = fo.airspeed_type;
+    vp->airspeed = fo.airspeed;
+    vp->heading_is_valid = fo.heading_is_valid;
+    vp->heading = fo.heading;
+    vp->vert_rate = fo.vert_rate;
+    vp->alt_diff = fo.alt_diff;
+    vp->velocitytime = to_stamp(timenow);
+    write_end(i-1);
+#if defined(TESTING)
+    check_velocity(i-1);
+#endif
 }
 
 // DF4 Mode S altitude replies - only altitude & ICAO ID
 void update_mode_s_traffic()
 {
-    // find in table, or try and create a new entry
-    int i = add_traffic_by_addr(fo.addr, fo.distance);
+    // find in table, or try and create a new (airborne) entry
+    int i = find_traffic_by_addr(fo.addr);
+    if (i == 0)
+        i = add_traffic_by_addr(fo.addr, fo.distance, false);
     if (i == 0)
         return;
-    ufo_t *fop = &container[i-1];
-    if (fop->latitude == 0) {       // do not overwrite fuller data if available from ADS-B
-        //if (fop->altitude == 0) {
-        if (fop->altitude != fo.altitude) {
+    int k = i-1;
+    if (tracks[k].latitude == 0) {  // do not overwrite fuller data if available from ADS-B
+        //if (altitudes[k] == 0) {
+        if (unpack_alt(altitudes[k], alt_types[k]) != fo.altitude) {
 if(settings->debug>1)
 Serial.printf("Mode S altitude %d for ID %06X\n", fo.altitude, fo.addr);
         }
-        fop->altitude = fo.altitude;
-        fop->positiontime = timenow;
+        write_begin(k);
+        altitudes[k] = pack_alt(fo.altitude, alt_types[k]);
+        container[k].positiontime = to_stamp(timenow);
+        write_end(k);
+        count_heard(k);
+        rank(k);
+        schedule(k);
     }
 }
 
-void traffic_update(int i)
+// DF20/21 Comm-B replies - only for aircraft already in the table,
+// since the ICAO ID is recovered from the parity assuming no errors
+void update_comm_b_traffic()
 {
-    ufo_t *fop = &container[i];
-    if (fop->addr == 0)
-        return;
-
-    // when should traffic objects expire (as long as there is room)?
-    uint32_t exptime = ENTRY_EXPIRATION_TIME;
-    if (num_tracked < MAX_TRACKING_OBJECTS)
-        exptime <<= 5;
-    if (timenow > fop->positiontime + exptime) {
-        i++;
-        delink_traffic_by_index(i);
-        //fop->addr = 0;
-        insert_traffic_by_index(i,0);   // link into the empty (0-address) list
+    int i = find_traffic_by_addr(fo.addr);
+    if (i == 0)
         return;
-    }
+    commb_t *cp = &commbs[i-1];
+    uint8_t f = fo.commb_fields;
+    write_begin(i-1);
+    if (f & CB_SELALT)
+        cp->sel_alt = fo.sel_alt;
+    if (f & CB_ROLL)
+        cp->roll = fo.roll;
+    if (f & CB_TAS)
+        cp->tas = fo.tas;
+    if (f & CB_IAS)
+        cp->ias = fo.ias;
+    if (f & CB_MACH)
+        cp->mach = fo.mach;
+    if (f & CB_MAGHDG)
+        cp->mag_heading = fo.mag_heading;
+    cp->commb_fields |= f;
+    cp->commbtime = to_stamp(timenow);
+    write_end(i-1);
+}
 
-    if (fop->positiontime == 0)   // only ID known, or position filtered out
+// the entries in the bucket for this second that have not been heard from
+// since they were put in it - the rest went into another bucket meanwhile
+static void expire_due(int b)
+{
+    // take the whole bucket, so that what goes back in is not seen again
+    int h = WHEEL_HEAD(b);
+    if (tnext[h] == h)
         return;
-
-    // keep track of which (non-followed) aircraft is farthest
-    if (fop->distance > farthest.dist && fop->addr != settings->follow) {
-        farthest.dist = fop->distance;
-        farthest.addr = fop->addr;
-        farthest.index1 = i+1;
-    } else if (fop->addr == farthest.addr) {
-        if (fop->distance < farthest.dist)
-            farthest.dist = fop->distance;   // may not really be the farthest any more
-    }
-    // keep track of which aircraft is closest
-    if (fop->distance > 0 && fop->distance < closest.dist) {
-        closest.dist = fop->distance;
-        closest.addr = fop->addr;
-        closest.index1 = i+1;
-    } else if (fop->addr == closest.addr) {
-        if (fop->distance > closest.dist)
-            closest.dist = fop->distance;   // may not really be the closest any more
+    tnext[DUE_HEAD] = tnext[h];
+    tprev[DUE_HEAD] = tprev[h];
+    tprev[tnext[h]] = DUE_HEAD;
+    tnext[tprev[h]] = DUE_HEAD;
+    tnext[h] = h;
+    tprev[h] = h;
+    for (int k = tnext[DUE_HEAD]; k != DUE_HEAD; k = tnext[DUE_HEAD]) {
+        if (timenow <= from_stamp(container[k].positiontime) + expiration_time(k)) {
+            schedule(k);                // (only after the clock jumped)
+        } else if (on_ground(k+1)) {
+            expire_traffic(k+1);
+            ++ground_expired;
+        } else {
+            timer_link(STALE_HEAD, k);  // not shown, until heard from again
+            heap_remove(&near_heap, k);
+        }
     }
+}
 
-#if defined(TESTING)
-    if (fop->updatetime < fop->velocitytime) {   // may lag by up to 1 second
-        float fgroundspeed = approxHypotenuse( (float)fop->nsv, (float)fop->ewv );
-        if ((float)fop->groundspeed > 1.05 * fgroundspeed)
-            ++upd_by_gs_incorrect[1];
-        else if ((float)fop->groundspeed < 0.95 * fgroundspeed)
-            ++upd_by_gs_incorrect[1];
-        else
-            ++upd_by_gs_incorrect[0];
-        float ftrack = atan2_approx((float)fop->nsv, (float)fop->ewv);
-        if (ftrack < 0)
-            ftrack += 360;
-        if (ftrack > 270 && fop->track < 90)
-            ftrack -= 360;
-        else if (ftrack < 90 && fop->track > 270)
-            ftrack += 360;
-        if (fop->groundspeed>0 && fabs(ftrack-fop->track) > 3)
-            ++upd_by_trk_incorrect[1];
-        else
-            ++upd_by_trk_incorrect[0];
+// and those kept for the longest while there was room
+static void expire_stale()
+{
+    for (int k = tnext[STALE_HEAD]; k != STALE_HEAD; k = tnext[STALE_HEAD]) {
+        if (timenow <= from_stamp(container[k].positiontime) + STALE_EXPIRATION_TIME)
+            break;
+        expire_traffic(k+1);
     }
-#endif
+}
 
-#if defined(TESTING)
-    if (fop->updatetime < fop->positiontime) {   // may lag by up to 1 second
-        float x, y;
-        y = (111300.0 * 0.00053996) * (fop->latitude - reflat); /* nm */
-        x = (111300.0 * 0.00053996) * (fop->longitude - reflon) * CosLat(reflat);
-        float fdistance = approxHypotenuse(x, y);
-        if (fop->distance > 1.02 * fdistance)
-            ++upd_by_dist_incorrect[1];
-        else if (fop->distance < 0.98 * fdistance)
-            ++upd_by_dist_incorrect[1];
-        else
-            ++upd_by_dist_incorrect[0];
-        int16_t fbearing = (int16_t) atan2_approx(y, x);     /* degrees from ref to target */
-        if (fbearing < 0)
-            fbearing += 360;
-        if (abs(fop->bearing - fbearing) > 2)
-            ++upd_by_brg_incorrect[1];
-        else
-            ++upd_by_brg_incorrect[0];
+#if defined(COMPACT_TABLE)
+// move the epoch forward, so that the times since it still fit in 16 bits
+static void roll_epoch()
+{
+    const uint32_t d = 0x4000;      // 4.5 hours, far older than anything kept
+    epoch += d;                     // - from_stamp() limits the times to timenow
+    for (int k=0; k<TRAFFIC_SLOTS; k++) {     //   until each one is re-based
+        slot_t *sp = &container[k];
+        stamp_t *times[4] = { &sp->positiontime, &velocities[k].velocitytime,
+                              &commbs[k].commbtime, &rates[k].firsttime };
+        write_begin(k);
+        for (int n=0; n < 4; n++) {
+            stamp_t s = *times[n];
+            if (s != 0)
+                *times[n] = (s <= d ? 1 : s - d);
+        }
+        write_end(k);
     }
-#endif
-
-    fop->updatetime = timenow;
 }
+#endif
 
 void traffic_setup()
 {
-    // link all the empty slots off of acindex[0]
-    // so that find_traffic_by_addr(0) will find them
-    acindex[0] = 1;   // pointing to container[0]
+    // start with an empty table (this may also be used to clear it)
+    for (int i=0; i<TRAFFIC_SLOTS; i++)
+        clear_entry(i);
+    memset(acindex, 0, sizeof(acindex));
+
+    // link all the empty slots into a list, in each partition
+    empties = 1;   // pointing to container[0]
     for (int i=0; i<MAX_TRACKING_OBJECTS-1; i++)
         container[i].next = i+2;
     container[MAX_TRACKING_OBJECTS-1].next = 0;
+    ground_empties = MAX_TRACKING_OBJECTS+1;
+    for (int i=MAX_TRACKING_OBJECTS; i<TRAFFIC_SLOTS-1; i++)
+        container[i].next = i+2;
+    container[TRAFFIC_SLOTS-1].next = 0;
 
-    //num_tracked = 0;
-    //farthest.dist = 0;
-    //farthest.addr = 0;
-    //farthest.index1 = 0;
-    //closest.dist = 9999.9;
-    //closest.addr = 0;
-    //closest.index1 = 0;
+    num_tracked = 0;
+    num_ground = 0;
+    memset(&evict_heap, 0, sizeof(evict_heap));
+    memset(&near_heap, 0, sizeof(near_heap));
+    for (int k=0; k<TIMER_NODES; k++) {
+        tnext[k] = k;
+        tprev[k] = k;
+    }
+    wheel_time = timenow;
+}
+
+// what the table takes, shown at startup
+void traffic_memory_report()
+{
+    int entry = sizeof(slot_t) + sizeof(cpr_track_t) + sizeof(alt_t) + sizeof(uint8_t)
+              + sizeof(velocity_t) + sizeof(identity_t) + sizeof(commb_t) + sizeof(rate_t);
+#if defined(THREADED)
+    entry += sizeof(uint32_t);      // seq[]
+#endif
+    int index = sizeof(acindex) + sizeof(evict_heap) + sizeof(near_heap)
+              + sizeof(tnext) + sizeof(tprev);
+    Serial.printf("traffic table%s: %d+%d entries of %d bytes (%d hot), indexes %d bytes, total %d bytes\n",
+#if defined(COMPACT_TABLE)
+        " (compact)",
+#else
+        "",
+#endif
+        MAX_TRACKING_OBJECTS, MAX_GROUND_OBJECTS, entry, (int) sizeof(slot_t),
+        index, TRAFFIC_SLOTS * entry + index);
 }
 
 void traffic_loop()
 {
-    // update some things (for all aircraft, one at a time) periodically
-    static unsigned int tick = 0;
-    static uint32_t nexttime = 0;
-    if (millis() < nexttime)
+    // once a second, expire the entries that are due - see schedule()
+    if (timenow == wheel_time)
         return;
-    nexttime = millis() + (3000/MAX_TRACKING_OBJECTS);   // each one every 3 seconds
-    tick++;
+    if (timenow - wheel_time > WHEEL_SIZE)
+        wheel_time = timenow - WHEEL_SIZE;    // once around is all of them
+    while (wheel_time != timenow)
+        expire_due(++wheel_time & (WHEEL_SIZE-1));
+    expire_stale();
 
-    // choose which entry to update this time around the loop
-    // assumes MAX_TRACKING_OBJECTS is a power of 2
-    int i = (tick & (MAX_TRACKING_OBJECTS-1));
-    if (i >= MAX_TRACKING_OBJECTS)
-        i = 0;                        // just to be safe
-
-    traffic_update(i);
+#if defined(COMPACT_TABLE)
+    if (timenow - epoch >= 0xC000)
+        roll_epoch();
+#endif
 
     ++ticks_by_numtracked[num_tracked];
 }
@@ -0,0 +1,92 @@
+/*
+ * Arduino.h - minimal Arduino/ESP32 HAL shim for the host (Linux) build
+ * Copyright (C) 2024 Moshe Braner
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version - see <http://www.gnu.org/licenses/>.
+ */
+
+// Only what dump5892 actually uses is provided here.  Time is virtual:
+// millis() and delay() run off a clock that hal.cpp advances either in step
+// with the wall clock, or (in max-speed replay) by the number of bytes that
+// would have taken that long to arrive at SERIAL_IN_BR.
+
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+typedef uint8_t byte;
+
+#define PROGMEM
+#define F(s)   (s)
+
+#define SERIAL_8N1  0x800001c
+
+uint32_t millis();
+uint32_t micros();
+void delay(uint32_t ms);
+void yield();
+char *strupr(char *s);
+
+class HardwareSerial
+{
+public:
+    explicit HardwareSerial(int uart) : uart_nr(uart) {}
+
+    void begin(unsigned long baud, uint32_t config=SERIAL_8N1,
+               int8_t rxPin=-1, int8_t txPin=-1);
+    void end() {}
+    void flush() { fflush(stdout); }
+    size_t setRxBufferSize(size_t n);
+    size_t setTxBufferSize(size_t n) { return n; }
+
+    int available();
+    int availableForWrite() { return 128; }   // "FIFO empty", never blocks
+    int read();
+    size_t readBytes(char *buffer, size_t length);
+    size_t readBytes(uint8_t *buffer, size_t length)
+        { return readBytes((char *) buffer, length); }
+
+    size_t write(uint8_t c) { return write((const char *) &c, 1); }
+    size_t write(const char *p, size_t n);
+    size_t write(const uint8_t *p, size_t n) { return write((const char *) p, n); }
+    size_t print(const char *s) { return write(s, strlen(s)); }
+    size_t print(char c) { return write((const char *) &c, 1); }
+    size_t print(int n) { return printf("%d", n); }
+    size_t print(unsigned int n) { return printf("%u", n); }
+    size_t print(long n) { return printf("%ld", n); }
+    size_t print(unsigned long n) { return printf("%lu", n); }
+    size_t print(double d) { return printf("%.2f", d); }
+    size_t println() { return print("\r\n"); }
+    template <typename T> size_t println(T x) { size_t n = print(x); return n + println(); }
+    size_t printf(const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+    operator bool() const { return true; }
+
+private:
+    int uart_nr;
+};
+
+extern HardwareSerial Serial;
+extern HardwareSerial Serial1;
+extern HardwareSerial Serial2;
+
+class EspClass
+{
+public:
+    void restart();
+    uint32_t getFreeHeap() { return 0; }
+    uint32_t getCycleCount();     // of a 240 MHz CPU, from the wall clock
+};
+
+extern EspClass ESP;
+
+#endif /* HOST_ARDUINO_H */
@@ -0,0 +1,35 @@
+/*
+ * EEPROM.h - EEPROM library shim for the host (Linux) build
+ * Copyright (C) 2024 Moshe Braner
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version - see <http://www.gnu.org/licenses/>.
+ */
+
+// This is found by EEPROM.cpp's #include <EEPROM.h>, in place of the
+// ESP32 library, while dump5892.h's #include "EEPROM.h" still gets the
+// settings layout from the sketch directory.  The contents live in RAM.
+
+#ifndef HOST_EEPROM_H
+#define HOST_EEPROM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+class EEPROMClass
+{
+public:
+    bool begin(size_t size) { return (size <= sizeof(data)); }
+    uint8_t read(int address) { return data[address]; }
+    void write(int address, uint8_t val) { data[address] = val; }
+    bool commit() { return true; }
+
+private:
+    uint8_t data[512];
+};
+
+extern EEPROMClass EEPROM;
+
+#endif /* HOST_EEPROM_H */
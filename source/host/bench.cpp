@@ -0,0 +1,1120 @@
+/*
+ * bench.cpp - benchmarks of the dump5892 decoding hot paths, on the host
+ * Copyright (C) 2024 Moshe Braner
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version - see <http://www.gnu.org/licenses/>.
+ */
+
+// Each benchmark runs one function of the sketch over a pool of inputs,
+// many times over, and reports the best and the median time per call among
+// several repeats.  The inputs are synthetic but deterministic: frames are
+// made up (with valid CRC) from a seeded pseudo-random generator, around
+// each of the given reference locations.  Along with the timing, each
+// result has a "check" value computed from what the function returned over
+// the pool, so that a change in behaviour between revisions shows up too.
+//
+// The results go out as JSON, for comparing between revisions:
+//
+//   ./bench -o before.json          (and after the change)  ./bench -o after.json
+//   ./bench -l 42.36,-71.0 -l 64.1,-21.9 -f cpr/
+//
+// The traffic table lookups are measured at table sizes up to the compiled-in
+// MAX_TRACKING_OBJECTS - build with "make MAXTRACK=512 bench" for 32 to 512 -
+// and the position updates with the table full, with traffic churning, and
+// with more traffic than fits, under each of the eviction policies.
+//
+// "./bench -c" does no timing, but checks that the NL lookup agrees with the
+// table at every latitude, and that the integer CPR decoding gives the same
+// positions as floating point did, all over the globe - and that the batch
+// decoding gives exactly the same as one frame at a time.  Built with "make
+// GRID=32 bench" it also sweeps the error of the distance/bearing grid.
+
+#include <time.h>
+#include <unistd.h>
+
+#include "Arduino.h"
+#include <EEPROM.h>
+#include "dump5892.h"
+#include "ApproxMath.h"
+
+#define POOL      256        // inputs per benchmark, a power of 2
+#define MAXREFS    16
+#define MAXRESULTS 256
+
+// settings the benchmarks run with
+#define BENCH_MAXRANGE  100  // so that there are far-away targets to reject early
+
+static uint32_t seed = 1;
+static int iterations = 1000000;
+static int repeats = 5;
+static const char *filter = NULL;
+
+static uint32_t rng;
+
+static uint32_t rnd()
+{
+    // xorshift32
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+static double rnd_uniform(double lo, double hi)
+{
+    return lo + (hi - lo) * (rnd() / 4294967296.0);
+}
+
+// --- frame construction, independent of the code being measured ---
+
+static uint32_t crc24(const uint8_t *b, int n)
+{
+    uint32_t crc = 0;
+    for (int i=0; i < n; i++) {
+        crc ^= ((uint32_t) b[i]) << 16;
+        for (int j=0; j < 8; j++) {
+            crc <<= 1;
+            if (crc & 0x1000000)
+                crc ^= 0x1FFF409;
+        }
+    }
+    return crc & 0xFFFFFF;
+}
+
+// pack bit fields, MSB first
+typedef struct {
+    uint8_t *p;
+    int pos;
+} bitw_t;
+
+static void put(bitw_t *w, int width, uint32_t v)
+{
+    for (int i=width-1; i >= 0; i--) {
+        if ((v >> i) & 1)
+            w->p[w->pos >> 3] |= (0x80 >> (w->pos & 7));
+        w->pos++;
+    }
+}
+
+// ES (112-bit) frame with PI = CRC, for DF17/18
+static void es_frame(uint8_t *b, int df, int ca, uint32_t icao)
+{
+    b[0] = (df << 3) | ca;
+    b[1] = icao >> 16;
+    b[2] = icao >> 8;
+    b[3] = icao;
+    uint32_t crc = crc24(b, 11);
+    b[11] = crc >> 16;
+    b[12] = crc >> 8;
+    b[13] = crc;
+}
+
+// Mode S frame with AP = CRC xor address, for DF0/4/16/20
+static void ap_frame(uint8_t *b, int nbytes, uint32_t icao)
+{
+    uint32_t ap = crc24(b, nbytes-3) ^ icao;
+    b[nbytes-3] = ap >> 16;
+    b[nbytes-2] = ap >> 8;
+    b[nbytes-1] = ap;
+}
+
+// the 13-bit AC field of the Mode S altitude replies, 25-foot (Q=1) coding
+static void put_ac13(uint8_t *b, int alt)
+{
+    int n = (alt + 1000) / 25;
+    b[2] |= (n >> 6) & 0x1F;
+    b[3] = (((n >> 5) & 1) << 7) | (((n >> 4) & 1) << 5) | 0x10 | (n & 0x0F);
+}
+
+static int cpr_NL(double lat)
+{
+    lat = fabs(lat);
+    if (lat < 1e-9)
+        return 59;
+    if (lat > 87.0)
+        return 1;
+    if (lat == 87.0)
+        return 2;
+    double a = 1.0 - cos(M_PI / 30.0);
+    double b = cos(M_PI / 180.0 * lat);
+    return (int) floor(2.0 * M_PI / acos(1.0 - a / (b * b)));
+}
+
+// airborne CPR encoding of a position, 17 bits each,
+//   and optionally the (quantized) position that a decoder should get back
+static void cpr_encode(double lat, double lon, int fflag, uint32_t *yz, uint32_t *xz,
+                       double *qlat = NULL, double *qlon = NULL)
+{
+    double dlat = 360.0 / (60 - fflag);
+    double y = floor(131072.0 * (fmod(fmod(lat, dlat) + dlat, dlat) / dlat) + 0.5);
+    double rlat = dlat * (y / 131072.0 + floor(lat / dlat));
+    int nl = cpr_NL(rlat) - fflag;
+    if (nl < 1)
+        nl = 1;
+    double dlon = 360.0 / nl;
+    double x = floor(131072.0 * (fmod(fmod(lon, dlon) + dlon, dlon) / dlon) + 0.5);
+    *yz = ((uint32_t) y) & 0x1FFFF;
+    *xz = ((uint32_t) x) & 0x1FFFF;
+    if (qlat) {
+        *qlat = rlat;
+        *qlon = fmod(dlon * (x / 131072.0 + floor(lon / dlon)) + 540.0, 360.0) - 180.0;
+    }
+}
+
+// a point at the given distance (nm) and bearing (degrees) from the reference
+static void offset(double dist, double brg, double *lat, double *lon)
+{
+    double b = brg * M_PI / 180.0;
+    *lat = cprref->reflat + dist / 60.0 * cos(b);
+    *lon = cprref->reflon + dist / 60.0 * sin(b) / cos(cprref->reflat * M_PI / 180.0);
+    if (*lon > 180)   *lon -= 360;
+    if (*lon < -180)  *lon += 360;
+}
+
+static int32_t deg2bam(double deg)
+{
+    return (int32_t) (uint32_t) (int64_t) llround(deg * (4294967296.0 / 360.0));
+}
+
+// --- the pools of inputs ---
+
+typedef struct {
+    char text[INPUT_MAX_SENTENCE];
+    int len;
+} sentence_t;
+
+static sentence_t sentences[POOL];
+static uint8_t frames[POOL][14];
+static mm_t cprs[POOL];
+static uint32_t bcprlat[POOL], bcprlon[POOL];    // cprs[] for decodeCPRbatch()
+static uint8_t bfflag[POOL];
+static int32_t blat[POOL], blon[POOL];
+static int8_t bstatus[POOL];
+static int32_t xs[POOL], ys[POOL];
+static float tlats[POOL], tlons[POOL];       // targets around the reference
+static int32_t tlatbams[POOL], tlonbams[POOL];
+static uint32_t addrs[POOL];
+static float dists[POOL];
+
+#define NUM_AIRCRAFT  24     // distinct IDs in the frames - fits in the table
+static uint32_t icaos[NUM_AIRCRAFT];
+
+static void to_sentence(sentence_t *s, const uint8_t *b, int nbytes)
+{
+    const char *hexdigits = "0123456789ABCDEF";
+    int k = 0;
+    int rssi = 24 + rnd() % 22;
+    s->text[k++] = '+';
+    s->text[k++] = hexdigits[rssi >> 4];
+    s->text[k++] = hexdigits[rssi & 15];
+    for (int i=0; i < nbytes; i++) {
+        s->text[k++] = hexdigits[b[i] >> 4];
+        s->text[k++] = hexdigits[b[i] & 15];
+    }
+    s->text[k] = '\0';
+    s->len = k;              // parse() gets the sentence without the ';'
+}
+
+enum {
+    FR_IDENTITY, FR_POSITION, FR_POSITION_FAR, FR_POSITION_WIDE, FR_VELOCITY, FR_DF18_POSITION,
+    FR_DF0, FR_DF4, FR_DF11, FR_DF16, FR_DF20,
+    FR_COMMB,      // DF20 or DF21 with BDS 4,0, 5,0 or 6,0 from aircraft in the table
+    FR_BUSY        // a mix as in busy airspace, mostly positions from afar
+};
+
+static void make_frame(uint8_t *b, int kind)
+{
+    memset(b, 0, 14);
+    uint32_t icao = icaos[rnd() % NUM_AIRCRAFT];
+    bitw_t w = { &b[4], 0 };
+    switch (kind) {
+    case FR_IDENTITY: {
+        static const char *chars = "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+        put(&w, 5, 4);                      // TC
+        put(&w, 3, 1 + rnd() % 7);          // category
+        for (int i=0; i < 3; i++)
+            put(&w, 6, chars[rnd() % 26] & 0x3F);
+        for (int i=0; i < 4; i++)
+            put(&w, 6, '0' + rnd() % 10);
+        put(&w, 6, ' ');
+        es_frame(b, 17, 5, icao);
+        break;
+    }
+    case FR_POSITION:
+    case FR_POSITION_FAR:
+    case FR_POSITION_WIDE:
+    case FR_DF18_POSITION: {
+        double lat, lon;
+        if (kind == FR_POSITION_FAR)         // beyond maxrange north or south
+            offset(rnd_uniform(BENCH_MAXRANGE + 20, 170), rnd_uniform(-30, 30) + 180 * (rnd() & 1), &lat, &lon);
+        else if (kind == FR_POSITION_WIDE)   // beyond maxrange east or west, not by latitude
+            offset(rnd_uniform(BENCH_MAXRANGE + 20, 170), rnd_uniform(70, 110) + 180 * (rnd() & 1), &lat, &lon);
+        else
+            offset(rnd_uniform(0, BENCH_MAXRANGE - 10), rnd_uniform(0, 360), &lat, &lon);
+        int fflag = rnd() & 1;
+        uint32_t yz, xz;
+        cpr_encode(lat, lon, fflag, &yz, &xz);
+        int n = (1000 + 100 * (rnd() % 450) + 1000) / 25;
+        put(&w, 5, 11);                     // TC
+        put(&w, 2, 0);
+        put(&w, 1, 0);
+        put(&w, 12, ((n >> 4) << 5) | 0x10 | (n & 0x0F));
+        put(&w, 1, 0);
+        put(&w, 1, fflag);
+        put(&w, 17, yz);
+        put(&w, 17, xz);
+        if (kind == FR_DF18_POSITION)
+            es_frame(b, 18, 2, icao);
+        else
+            es_frame(b, 17, 5, icao);
+        break;
+    }
+    case FR_VELOCITY: {
+        int ew = (int) (rnd() % 801) - 400;
+        int ns = (int) (rnd() % 801) - 400;
+        int vr = (int) (rnd() % 61) - 30;
+        put(&w, 5, 19);
+        put(&w, 3, 1);                      // subtype: ground speed
+        put(&w, 5, 0);
+        put(&w, 1, ew < 0);
+        put(&w, 10, abs(ew) + 1);
+        put(&w, 1, ns < 0);
+        put(&w, 10, abs(ns) + 1);
+        put(&w, 1, 1);
+        put(&w, 1, vr < 0);
+        put(&w, 9, abs(vr) + 1);
+        put(&w, 3, 0);
+        put(&w, 7, 5);
+        es_frame(b, 17, 5, icao);
+        break;
+    }
+    case FR_DF0:
+    case FR_DF4:
+        b[0] = (kind == FR_DF0 ? 0 : 4) << 3;
+        put_ac13(b, 100 * (rnd() % 450));
+        ap_frame(b, 7, icao);
+        break;
+    case FR_DF16:
+    case FR_DF20:
+        b[0] = (kind == FR_DF16 ? 16 : 20) << 3;
+        put_ac13(b, 100 * (rnd() % 450));
+        ap_frame(b, 14, icao);
+        break;
+    case FR_COMMB: {
+        static const uint8_t mbs[3][7] = {
+            { 0x85, 0xE4, 0x2F, 0x31, 0x30, 0x00, 0x00 },    // 4,0: 3008 ft, 1020 mb
+            { 0x81, 0x95, 0x15, 0x36, 0xE0, 0x24, 0xD4 },    // 5,0: roll 2.1, 438 kt, TAS 424
+            { 0x8F, 0x39, 0xF9, 0x1A, 0x7E, 0x27, 0xC4 },    // 6,0: 43 deg, IAS 252, M.42
+        };
+        b[0] = (rnd() & 1 ? 20 : 21) << 3;
+        put_ac13(b, 100 * (rnd() % 450));
+        memcpy(&b[4], mbs[rnd() % 3], 7);
+        ap_frame(b, 14, icao);
+        break;
+    }
+    case FR_DF11:
+        b[0] = (11 << 3) | 5;
+        b[1] = icao >> 16;
+        b[2] = icao >> 8;
+        b[3] = icao;
+        ap_frame(b, 7, 0);
+        break;
+    }
+}
+
+static int frame_bytes(int kind)
+{
+    return (kind == FR_DF0 || kind == FR_DF4 || kind == FR_DF11) ? 7 : 14;
+}
+
+static void make_sentences(int kind)
+{
+    for (int i=0; i < POOL; i++) {
+        uint8_t b[14];
+        int k = kind;
+        if (kind == FR_BUSY) {
+            static const uint8_t mix[20] = {
+                FR_POSITION_FAR, FR_POSITION_FAR, FR_POSITION_FAR, FR_POSITION_FAR,
+                FR_POSITION_FAR, FR_POSITION_FAR, FR_POSITION_FAR, FR_POSITION_FAR,
+                FR_POSITION_FAR, FR_POSITION_FAR, FR_POSITION_FAR, FR_POSITION_FAR,
+                FR_POSITION, FR_POSITION, FR_POSITION,
+                FR_VELOCITY, FR_VELOCITY, FR_VELOCITY,
+                FR_IDENTITY, FR_IDENTITY
+            };
+            k = mix[rnd() % 20];
+        }
+        make_frame(b, k);
+        to_sentence(&sentences[i], b, frame_bytes(k));
+    }
+}
+
+// targets around the reference location that decodeCPRrelative() handles
+// with the given effort (0: same NL zone, 1: adjacent, 2: full NL search),
+// or any (-1), mixed as they come
+static int make_cprs(int effort)
+{
+    int n = 0;
+    for (int tries=0; tries < 200000 && n < POOL; tries++) {
+        double lat = cprref->reflat + rnd_uniform(-2.9, 2.9);
+        double lon = cprref->reflon + rnd_uniform(-2.9, 2.9);
+        if (fabs(lat) > 85)
+            continue;
+        mm = EmptyMsg;
+        mm.fflag = rnd() & 1;
+        cpr_encode(lat, lon, mm.fflag, &mm.cprlat, &mm.cprlon);
+        if (decodeCPRrelative(cprref) == effort || effort < 0)
+            cprs[n++] = mm;
+    }
+    for (int i=n; n > 0 && i < POOL; i++)    // repeat to fill the pool
+        cprs[i] = cprs[i % n];
+    return n;
+}
+
+// fill the traffic table with n aircraft, and set up IDs to look for
+static void make_table(int n, bool present)
+{
+    traffic_setup();
+    for (int i=0; i < n; i++) {
+        fo = EmptyFO;
+        fo.addr = icaos[i % NUM_AIRCRAFT] + (i / NUM_AIRCRAFT);
+        fo.distance = 1 + i;
+        update_traffic_position();
+    }
+    for (int i=0; i < POOL; i++) {
+        int j = rnd() % n;
+        if (present)
+            addrs[i] = icaos[j % NUM_AIRCRAFT] + j / NUM_AIRCRAFT;
+        else
+            addrs[i] = 0x800000 | (rnd() & 0x7FFFFF);   // (icaos[] are < 0x800000)
+        if (present && find_traffic_by_addr(addrs[i]) == 0)
+            addrs[i] = icaos[0];                      // (for n < NUM_AIRCRAFT)
+    }
+}
+
+// --- the functions measured, each on the i'th input of its pool ---
+
+static uint32_t b_empty(int i)      { return i; }
+static uint32_t b_parse(int i)      { return parse(sentences[i].text, sentences[i].len); }
+static uint32_t b_crc56(int i)      { memcpy(msg, frames[i], 7);  return check_crc(7); }
+static uint32_t b_crc112(int i)     { memcpy(msg, frames[i], 14); return check_crc(14); }
+static uint32_t b_crcbits(int i)    { memcpy(msg, frames[i], 14); return mode_s_checksum_bitwise(14); }
+static uint32_t b_hypot(int i)      { return iapproxHypotenuse1(xs[i], ys[i]); }
+static uint32_t b_atan2(int i)      { return iatan2_approx(ys[i], xs[i]); }
+static uint32_t b_find(int i)       { return find_traffic_by_addr(addrs[i]); }
+
+// A day of traffic coming and going, a second at a time: CHURN_PER_HOUR
+// aircraft an hour, each heard from for 2 to 17 minutes, so that there are
+// always far more than the table holds, and CHURN_MESSAGES positions a
+// second from those still around - so the time is per simulated second,
+// traffic_loop() and all, and the entries are replaced, go quiet and
+// expire as they would.
+#define CHURN_PER_HOUR  4000
+#define CHURN_MESSAGES    32
+
+static uint32_t churn_t0;
+
+static uint32_t b_churn(int i)
+{
+    ++timenow;
+    traffic_loop();
+    uint32_t t = timenow - churn_t0;
+    uint32_t last = t * CHURN_PER_HOUR / 3600;       // the latest to arrive
+    for (int m=0; m < CHURN_MESSAGES; m++) {
+        uint32_t n = last - rnd() % (17 * CHURN_PER_HOUR / 60);
+        if (n > last)
+            continue;                                 // (not yet, at the start)
+        uint32_t h = n * 2654435769u;
+        uint32_t start = n * 3600 / CHURN_PER_HOUR;
+        if (t >= start + 120 + (h >> 8) % 900)
+            continue;                                 // gone
+        fo = EmptyFO;
+        fo.addr = 0x100000 + (n & 0xFFFFF);
+        fo.distance = 1 + (h >> 20) % 200 + 0.1f * ((t - start) % 60);
+        update_traffic_position();
+    }
+    return num_tracked;
+}
+
+// More traffic than the table holds, as near a busy airport under the
+// airways: OVERLOAD_FAR airliners at FL250 to FL400, 2 to 40 nm out, and
+// OVERLOAD_NEAR gliders and light aircraft within 15 nm and 3000 ft of our
+// own altitude, OVERLOAD_MESSAGES messages a second among them, one in 8
+// from the near ones, and one in 8 an identity message.  The check is
+// of how many positions from the near ones were lost each second - not
+// in the table right after they came in - under each eviction policy.
+#define OVERLOAD_FAR      (4*MAX_TRACKING_OBJECTS)
+#define OVERLOAD_NEAR     (MAX_TRACKING_OBJECTS/4)
+#define OVERLOAD_MESSAGES 32
+#define OVERLOAD_OWNALT   2000
+
+static uint32_t overload_lost, overload_near;
+
+static uint32_t b_overload(int i)
+{
+    ++timenow;
+    traffic_loop();
+    uint32_t lost = 0;
+    for (int m=0; m < OVERLOAD_MESSAGES; m++) {
+        uint32_t r = rnd();
+        bool near = ((r & 7) == 0);
+        uint32_t n = (r >> 3) % (near ? OVERLOAD_NEAR : OVERLOAD_FAR);
+        uint32_t h = (n + (near ? OVERLOAD_FAR : 0)) * 2654435769u;
+        fo = EmptyFO;
+        fo.addr = (near ? 0x300000 : 0x200000) + n;
+        if (((r >> 16) & 7) == 0) {
+            fo.aircraft_type = (near ? ((h >> 4) & 1 ? 1 : 9) : 13);
+            update_traffic_identity();
+            continue;
+        }
+        float drift = 0.1f * ((timenow + (h >> 24)) % 40);
+        if (near) {
+            fo.distance = 1 + (h >> 8) % 120 * 0.1f + drift;
+            fo.altitude = OVERLOAD_OWNALT - 3000 + (h >> 20) % 61 * 100;
+        } else {
+            fo.distance = 2 + (h >> 8) % 340 * 0.1f + drift;
+            fo.altitude = 25000 + (h >> 20) % 151 * 100;
+        }
+        update_traffic_position();
+        if (near) {
+            ++overload_near;
+            if (find_traffic_by_addr(fo.addr) == 0) {
+                ++overload_lost;
+                ++lost;
+            }
+        }
+    }
+    return lost;
+}
+
+// a position from an aircraft in the (full) table or a new one, each at a
+// new distance - so the re-ranking, and the replacing of the most expendable
+static uint32_t b_position(int i)
+{
+    fo = EmptyFO;
+    fo.addr = addrs[i];
+    fo.distance = dists[i];
+    update_traffic_position();
+    return find_closest_traffic();
+}
+
+// distance & bearing as parse_position() works them out without the grid
+static void dstbrg_arith(float lat, float lon, float *dst, int *brg)
+{
+    const cprref_t *ref = cprref;
+    uint32_t y = (uint32_t)((111300.0 * 0.53996) * (lat - ref->reflat)); // nm * 1000
+    uint32_t x = (uint32_t)((111300.0 * 0.53996) * (lon - ref->reflon) * CosLat(ref->reflat));
+    *dst = 0.001 * (float)iapproxHypotenuse1(x, y);
+    *brg = 0;
+    if (*dst != 0) {
+        *brg = iatan2_approx(y,x);
+        if (*brg < 0)
+            *brg += 360;
+    }
+}
+
+static uint32_t b_dstbrg_arith(int i)
+{
+    float dst;
+    int brg;
+    dstbrg_arith(tlats[i], tlons[i], &dst, &brg);
+    return (uint32_t) (dst * 10) + brg;
+}
+
+#if defined(DSTBRG_GRID)
+static uint32_t b_dstbrg_grid(int i)
+{
+    mm.latbam = tlatbams[i];
+    mm.lonbam = tlonbams[i];
+    dstbrg_lookup(cprref);
+    return (uint32_t) (fo.distance * 10) + fo.bearing;
+}
+#endif
+static uint32_t b_cpr(int i)
+{
+    mm = cprs[i];
+    int effort = decodeCPRrelative(cprref);
+    return effort + (uint32_t) (fo.latitude * 1000) + (uint32_t) (fo.longitude * 1000);
+}
+
+// the whole pool in one call, every POOL calls - so the time is per frame
+static uint32_t b_cpr_batch(int i)
+{
+    if (i != 0)
+        return 0;
+    uint32_t check = decodeCPRbatch(cprref, POOL, bcprlat, bcprlon, bfflag, blat, blon, bstatus);
+    for (int j=0; j < POOL; j++)
+        check = check * 31 + (uint32_t) blat[j] + (uint32_t) blon[j] + bstatus[j];
+    return check;
+}
+
+// --- running and reporting ---
+
+typedef struct {
+    const char *name;
+    char ref[32];
+    double ns_min, ns_median;
+    uint32_t check;
+} result_t;
+
+static result_t results[MAXRESULTS];
+static int nresults = 0;
+static const char *curref = "";
+
+static volatile uint32_t sink;
+
+static double now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+static void run(const char *name, uint32_t (*fn)(int))
+{
+    if (filter && strstr(name, filter) == NULL)
+        return;
+    if (nresults >= MAXRESULTS)
+        return;
+    result_t *r = &results[nresults++];
+    r->name = name;
+    snprintf(r->ref, sizeof(r->ref), "%s", curref);
+    // one pass to compute the check value (and warm up the caches)
+    uint32_t check = 0;
+    for (int i=0; i < POOL; i++)
+        check = check * 31 + fn(i);
+    r->check = check;
+    double t[32];
+    int reps = (repeats > 32 ? 32 : repeats);
+    for (int k=0; k < reps; k++) {
+        uint32_t s = 0;
+        double t0 = now_ns();
+        for (int j=0; j < iterations; j++)
+            s += fn(j & (POOL-1));
+        t[k] = (now_ns() - t0) / iterations;
+        sink = s;
+    }
+    qsort(t, reps, sizeof(double), cmp_double);
+    r->ns_min = t[0];
+    r->ns_median = t[reps/2];
+    fprintf(stderr, "%-36s %-20s %8.2f ns\n", name, curref, r->ns_min);
+}
+
+static void bench_location(float lat, float lon)
+{
+    static char ref[32];
+    snprintf(ref, sizeof(ref), "%.4f,%.4f", lat, lon);
+    curref = ref;
+    settings->latitude = lat;
+    settings->longitude = lon;
+    CPRRelative_precomp();
+
+    static const struct {
+        const char *name;
+        int kind;
+        int negttl;         // 0: each position rejected all the way through
+    } parses[] = {
+        { "parse/DF17_identity",        FR_IDENTITY,      5 },
+        { "parse/DF17_position",        FR_POSITION,      5 },
+        { "parse/DF17_position_reject", FR_POSITION_FAR,  5 },
+        { "parse/DF17_velocity",        FR_VELOCITY,      5 },
+        { "parse/DF18_position",        FR_DF18_POSITION, 5 },
+        { "parse/DF0_altitude",         FR_DF0,           5 },
+        { "parse/DF4_altitude",         FR_DF4,           5 },
+        { "parse/DF11_allcall",         FR_DF11,          5 },
+        { "parse/DF16_altitude",        FR_DF16,          5 },
+        { "parse/DF20_altitude",        FR_DF20,          5 },
+        { "parse/busy_mix",             FR_BUSY,          5 },
+        { "parse/DF17_position_wide",   FR_POSITION_WIDE, 0 },
+        { "parse/DF17_position_negcache", FR_POSITION_WIDE, 5 },
+        { "parse/DF20_21_commb",        FR_COMMB,         5 },
+    };
+    for (unsigned k=0; k < sizeof(parses)/sizeof(parses[0]); k++) {
+        rng = seed + k;
+        make_sentences(parses[k].kind);
+        traffic_setup();
+        if (parses[k].kind == FR_COMMB)
+            make_table(NUM_AIRCRAFT, true);
+        negcache_clear();
+        settings->negttl = parses[k].negttl;
+        run(parses[k].name, b_parse);
+    }
+    settings->negttl = 5;
+
+    rng = seed + 110;
+    for (int i=0; i < POOL; i++) {
+        double lat, lon;
+        offset(rnd_uniform(0.5, 180.0), rnd_uniform(0, 360), &lat, &lon);
+        tlats[i] = lat;
+        tlons[i] = lon;
+        tlatbams[i] = deg2bam(lat);
+        tlonbams[i] = deg2bam(lon);
+    }
+    run("math/dstbrg_arith", b_dstbrg_arith);
+#if defined(DSTBRG_GRID)
+    run("math/dstbrg_grid", b_dstbrg_grid);
+#endif
+
+    static const char *cprnames[3] = {
+        "cpr/decodeCPRrelative_effort0",
+        "cpr/decodeCPRrelative_effort1",
+        "cpr/decodeCPRrelative_effort2"
+    };
+    for (int effort=0; effort < 3; effort++) {
+        rng = seed + 100 + effort;
+        if (make_cprs(effort) > 0)        // e.g., no NL zone changes near the equator
+            run(cprnames[effort], b_cpr);
+    }
+    rng = seed + 103;
+    make_cprs(-1);
+    for (int i=0; i < POOL; i++) {
+        bcprlat[i] = cprs[i].cprlat;
+        bcprlon[i] = cprs[i].cprlon;
+        bfflag[i] = cprs[i].fflag;
+    }
+    run("cpr/decodeCPRrelative_mixed", b_cpr);
+    run("cpr/decodeCPRbatch_mixed", b_cpr_batch);
+    curref = "";
+}
+
+// the lost positions over the first POOL seconds, then the timing
+static void run_overload(const char *name, int policy)
+{
+    if (filter && strstr(name, filter) == NULL)
+        return;
+    uint8_t evict = settings->evict;
+    uint16_t ownalt = settings->ownalt;
+    settings->evict = policy;
+    settings->ownalt = OVERLOAD_OWNALT / 100;
+    traffic_setup();
+    rng = seed + 400;
+    overload_lost = overload_near = 0;
+    for (int i=0; i < POOL; i++)
+        b_overload(i);
+    fprintf(stderr, "%-36s %-20s lost %u of %u near positions\n",
+        name, curref, overload_lost, overload_near);
+    traffic_setup();
+    rng = seed + 400;
+    run(name, b_overload);
+    settings->evict = evict;
+    settings->ownalt = ownalt;
+}
+
+static void bench_general()
+{
+    rng = seed + 200;
+    for (int i=0; i < POOL; i++) {
+        make_frame(frames[i], i & 1 ? FR_POSITION : FR_DF4);
+        if (i & 2)
+            frames[i][5 + rnd() % 6] ^= 1 << (rnd() & 7);    // some with errors
+    }
+    run("crc/check_crc_56", b_crc56);
+    run("crc/check_crc_112", b_crc112);
+    run("crc/bitwise_112", b_crcbits);
+
+    for (int i=0; i < POOL; i++) {
+        xs[i] = (int32_t) (rnd() % 400001) - 200000;   // nm * 1000, as in parse_position()
+        ys[i] = (int32_t) (rnd() % 400001) - 200000;
+    }
+    run("math/iapproxHypotenuse1", b_hypot);
+    run("math/iatan2_approx", b_atan2);
+
+    static const struct {
+        const char *hit;
+        const char *miss;
+        int n;
+    } tables[] = {
+        { "traffic/find_by_addr_hit_1",  "traffic/find_by_addr_miss_1",  1 },
+        { "traffic/find_by_addr_hit_16", "traffic/find_by_addr_miss_16", 16 },
+        { "traffic/find_by_addr_hit_32", "traffic/find_by_addr_miss_32", 32 },
+        { "traffic/find_by_addr_hit_64", "traffic/find_by_addr_miss_64", 64 },
+        { "traffic/find_by_addr_hit_128", "traffic/find_by_addr_miss_128", 128 },
+        { "traffic/find_by_addr_hit_256", "traffic/find_by_addr_miss_256", 256 },
+        { "traffic/find_by_addr_hit_512", "traffic/find_by_addr_miss_512", 512 },
+    };
+    uint32_t t = timenow;
+    timenow = 1000;         // so that the entries have recent positions
+    for (unsigned k=0; k < sizeof(tables)/sizeof(tables[0]); k++) {
+        int n = tables[k].n;
+        if (n > MAX_TRACKING_OBJECTS)
+            break;          // (make MAXTRACK=512 bench for the larger tables)
+        make_table(n, true);
+        run(tables[k].hit, b_find);
+        make_table(n, false);
+        run(tables[k].miss, b_find);
+    }
+    make_table(MAX_TRACKING_OBJECTS, true);
+    for (int i=0; i < POOL; i++) {
+        if (i & 1)
+            addrs[i] = 0x800000 | (rnd() & 0x7FFFFF);
+        dists[i] = 1 + rnd() % (2*MAX_TRACKING_OBJECTS);
+    }
+    run("traffic/update_position_full", b_position);
+    traffic_setup();
+    churn_t0 = timenow;
+    rng = seed + 300;
+    run("traffic/churn", b_churn);
+    run_overload("traffic/overload_distance", EVICTDIST);
+    run_overload("traffic/overload_priority", EVICTPRIO);
+    timenow = t;
+    traffic_setup();
+}
+
+// --- the check (-c) that the integer CPR decoding agrees with floating point ---
+
+// decodeCPRrelative() as it was, in floating point, for any reference location
+static void cpr_float_relative(float reflat, float reflon, int fflag,
+                               uint32_t cprlat, uint32_t cprlon, float *lat, float *lon)
+{
+    float fractional_lat = cprlat * 7.629394531e-6;
+    float fractional_lon = cprlon * 7.629394531e-6;
+    float dlat = 360.0 / (60 - fflag);
+    float scaled = reflat * (fflag ? 59.0/360.0 : 60.0/360.0);
+    float flr = floor(scaled);
+    float j = flr + floor(0.5 + (scaled - flr) - fractional_lat);
+    float rlat = dlat * (j + fractional_lat);
+    if (rlat >= 270) rlat -= 360;
+    int nl = cpr_NL(rlat) - fflag;
+    if (nl < 1)
+        nl = 1;
+    float dlon = 360.0 / nl;
+    scaled = reflon * (nl / 360.0);
+    flr = floor(scaled);
+    float m = flr + floor(0.5 + (scaled - flr) - fractional_lon);
+    float rlon = dlon * (m + fractional_lon);
+    if (rlon > 180) rlon -= 360;
+    *lat = rlat;
+    *lon = rlon;
+}
+
+// the NL thresholds from 1090-WP-9-14: NL is 59 below the first, and so on
+static const double NLedges[58] = {
+    10.47047130, 14.82817437, 18.18626357, 21.02939493, 23.54504487, 25.82924707,
+    27.93898710, 29.91135686, 31.77209708, 33.53993436, 35.22899598, 36.85025108,
+    38.41241892, 39.92256684, 41.38651832, 42.80914012, 44.19454951, 45.54626723,
+    46.86733252, 48.16039128, 49.42776439, 50.67150166, 51.89342469, 53.09516153,
+    54.27817472, 55.44378444, 56.59318756, 57.72747354, 58.84763776, 59.95459277,
+    61.04917774, 62.13216659, 63.20427479, 64.26616523, 65.31845310, 66.36171008,
+    67.39646774, 68.42322022, 69.44242631, 70.45451075, 71.45986473, 72.45884545,
+    73.45177442, 74.43893416, 75.42056257, 76.39684391, 77.36789461, 78.33374083,
+    79.29428225, 80.24923213, 81.19801349, 82.13956981, 83.07199445, 83.99173563,
+    84.89166191, 85.75541621, 86.53536998, 87.00000000
+};
+
+// cprNLFunction() against the table, at every latitude (binary angle) from
+// the south pole to the north pole - returns the number of mismatches
+static long nl_check()
+{
+    long bad = 0;
+    int k = 0;            // NLedges[k] is the next threshold going north
+    for (uint32_t a = 0; a <= (1u << 30); a++) {
+        double deg = a * (360.0 / 4294967296.0);
+        while (k < 58 && deg >= NLedges[k])
+            ++k;
+        int nl = 59 - k;
+        if (cprNLFunction((int32_t) a) != nl || cprNLFunction(- (int32_t) a) != nl) {
+            if (bad++ < 10)
+                fprintf(stderr, "  NL mismatch at %.9f: %d vs %d\n", deg, cprNLFunction((int32_t) a), nl);
+        }
+    }
+    return bad;
+}
+
+// difference in longitude, across +-180
+static double londiff(double a, double b)
+{
+    double d = fmod(a - b + 540.0, 360.0) - 180.0;
+    return fabs(d);
+}
+
+// Sweep reference locations over the globe, and targets within half a zone
+// of each, comparing decodeCPRrelative() with the floating-point version and
+// with the exact position that was encoded.  Differences are in units of
+// the CPR resolution (1/2^17 zone) at the target.
+static int cpr_check()
+{
+    long nlbad = nl_check();
+    fprintf(stderr, "NL check: %ld latitudes differ from the table\n", nlbad);
+
+    long refs = 0, n = 0, failed = 0, disagree = 0, inexact = 0, float_wrong = 0;
+    long batch_differ = 0;
+    double worst_vs_float = 0, worst_vs_exact = 0, worst_float = 0;
+    rng = seed + 400;
+    for (double rlat = -87.0; rlat <= 87.0; rlat += 0.25) {
+        for (double rlon = -180.0; rlon < 180.0; rlon += 2.5) {
+            settings->latitude = rlat + rnd_uniform(0, 0.25);
+            settings->longitude = rlon + rnd_uniform(0, 2.5);
+            CPRRelative_precomp();
+            ++refs;
+            int nb = 0;               // the same frames for decodeCPRbatch()
+            for (int t=0; t < 8; t++) {
+                double lat = cprref->reflat + rnd_uniform(-2.9, 2.9);
+                double lon = cprref->reflon + rnd_uniform(-2.9, 2.9);
+                if (fabs(lat) > 89.9)
+                    continue;
+                for (int f=0; f < 2; f++) {
+                    double qlat, qlon;
+                    mm = EmptyMsg;
+                    mm.fflag = f;
+                    cpr_encode(lat, lon, f, &mm.cprlat, &mm.cprlon, &qlat, &qlon);
+                    ++n;
+                    bcprlat[nb] = mm.cprlat;
+                    bcprlon[nb] = mm.cprlon;
+                    bfflag[nb] = f;
+                    bstatus[nb] = decodeCPRrelative(cprref);
+                    blat[nb] = mm.latbam;
+                    blon[nb] = mm.lonbam;
+                    ++nb;
+                    if (bstatus[nb-1] < 0) {
+                        ++failed;
+                        continue;
+                    }
+                    float flat, flon;
+                    cpr_float_relative(cprref->reflat, cprref->reflon, f, mm.cprlat, mm.cprlon, &flat, &flon);
+                    int ni = cpr_NL(qlat) - f;
+                    double latlsb = 360.0 / (60 - f) / 131072.0;
+                    double lonlsb = 360.0 / (ni < 1 ? 1 : ni) / 131072.0;
+                    double d = fmax(fabs(fo.latitude - qlat) / latlsb, londiff(fo.longitude, qlon) / lonlsb);
+                    if (d > 1.0)
+                        ++inexact;
+                    worst_vs_exact = fmax(worst_vs_exact, d);
+                    d = fmax(fabs(flat - qlat) / latlsb, londiff(flon, qlon) / lonlsb);
+                    if (d > 1.0) {
+                        ++float_wrong;        // e.g., it did not wrap around -180
+                        continue;
+                    }
+                    worst_float = fmax(worst_float, d);
+                    d = fmax(fabs(fo.latitude - flat) / latlsb, londiff(fo.longitude, flon) / lonlsb);
+                    if (d > 1.0)
+                        ++disagree;
+                    worst_vs_float = fmax(worst_vs_float, d);
+                }
+            }
+            // the batch must come out exactly the same as one at a time
+            int32_t lats[16], lons[16];
+            int8_t status[16];
+            decodeCPRbatch(cprref, nb, bcprlat, bcprlon, bfflag, lats, lons, status);
+            for (int i=0; i < nb; i++) {
+                if (status[i] != bstatus[i]
+                      || (status[i] >= 0 && (lats[i] != blat[i] || lons[i] != blon[i])))
+                    ++batch_differ;
+            }
+        }
+    }
+    fprintf(stderr, "cpr check: %ld positions around %ld reference locations\n", n, refs);
+    fprintf(stderr, "  failed to decode:                           %ld\n", failed);
+    fprintf(stderr, "  more than 1 LSB from the exact position:    %ld  (worst %.3f LSB)\n", inexact, worst_vs_exact);
+    fprintf(stderr, "  more than 1 LSB from floating point:        %ld  (worst %.3f LSB)\n", disagree, worst_vs_float);
+    fprintf(stderr, "  where floating point itself was that wrong: %ld  (otherwise worst %.3f LSB)\n",
+        float_wrong, worst_float);
+    fprintf(stderr, "  decodeCPRbatch() differing from the above:  %ld\n", batch_differ);
+    return (nlbad || failed || disagree || inexact || batch_differ) ? 1 : 0;
+}
+
+#if defined(DSTBRG_GRID)
+// --- and of the distance/bearing grid, along with the arithmetic it replaces ---
+
+typedef struct {
+    long n, dst_bad, brg_bad;       // as counted by the TESTING checks in traffic.cpp
+    double dst_worst, brg_worst;    // relative, and degrees
+} dstbrg_err_t;
+
+static void dstbrg_tally(dstbrg_err_t *e, double dist, double brg, float dst, int b)
+{
+    ++e->n;
+    double de = fabs(dst - dist) / dist;
+    double be = fabs(fmod(b - brg + 540.0, 360.0) - 180.0);
+    if (de > 0.02)
+        ++e->dst_bad;
+    if (be > 2)
+        ++e->brg_bad;
+    e->dst_worst = fmax(e->dst_worst, de);
+    e->brg_worst = fmax(e->brg_worst, be);
+}
+
+static void dstbrg_report(const char *name, dstbrg_err_t *e)
+{
+    fprintf(stderr, "  %-6s distance: %5ld off by > 2%%   (worst %.3f%%)\n",
+        name, e->dst_bad, 100 * e->dst_worst);
+    fprintf(stderr, "  %-6s bearing:  %5ld off by > 2 deg (worst %.2f deg)\n",
+        name, e->brg_bad, e->brg_worst);
+}
+
+// Targets at 0.1 to 250 nm (evenly on a log scale) in all directions, from
+// references at all latitudes, compared with the exact flat-earth distance
+// and bearing - the bearings being whole degrees, they are off by up to 0.5.
+static int dstbrg_check()
+{
+    dstbrg_err_t grid = {0}, arith = {0};
+    rng = seed + 500;
+    for (double rlat = -85.0; rlat <= 85.0; rlat += 5.0) {
+        settings->latitude = rlat + rnd_uniform(0, 5.0);
+        settings->longitude = rnd_uniform(-180, 180);
+        CPRRelative_precomp();
+        for (int t=0; t < 20000; t++) {
+            double dist = 0.1 * pow(2500.0, rnd_uniform(0, 1));
+            double brg = rnd_uniform(0, 360);
+            double lat, lon;
+            offset(dist, brg, &lat, &lon);
+            mm.latbam = deg2bam(lat);
+            mm.lonbam = deg2bam(lon);
+            dstbrg_lookup(cprref);
+            dstbrg_tally(&grid, dist, brg, fo.distance, fo.bearing);
+            float dst;
+            int b;
+            dstbrg_arith(lat, lon, &dst, &b);
+            dstbrg_tally(&arith, dist, brg, dst, b);
+        }
+    }
+    fprintf(stderr, "dstbrg check: %ld positions, %dx%d grid\n", grid.n, DSTBRG_GRID, DSTBRG_GRID);
+    dstbrg_report("grid", &grid);
+    dstbrg_report("arith", &arith);
+    // the bound documented in dstbrg.cpp, plus the rounding to whole degrees
+    return (grid.dst_worst > 0.002 || grid.brg_worst > 0.6) ? 1 : 0;
+}
+#endif
+
+static void json_out(FILE *f, int nrefs, float *lats, float *lons)
+{
+    fprintf(f, "{\n  \"suite\": \"%s\",\n  \"version\": \"%s\",\n", FIRMWARE_IDENT, FIRMWARE_VERSION);
+    fprintf(f, "  \"iterations\": %d,\n  \"repeats\": %d,\n  \"seed\": %u,\n  \"pool\": %d,\n",
+        iterations, repeats, seed, POOL);
+    fprintf(f, "  \"max_tracking_objects\": %d,\n  \"maxrange\": %d,\n", MAX_TRACKING_OBJECTS, BENCH_MAXRANGE);
+    fprintf(f, "  \"refs\": [");
+    for (int i=0; i < nrefs; i++)
+        fprintf(f, "%s\"%.4f,%.4f\"", (i ? ", " : ""), lats[i], lons[i]);
+    fprintf(f, "],\n  \"results\": [\n");
+    for (int i=0; i < nresults; i++) {
+        result_t *r = &results[i];
+        fprintf(f, "    {\"name\": \"%s\", \"ref\": \"%s\", \"ns_per_op\": %.3f, \"ns_median\": %.3f, \"check\": %u}%s\n",
+            r->name, r->ref, r->ns_min, r->ns_median, r->check, (i < nresults-1 ? "," : ""));
+    }
+    fprintf(f, "  ]\n}\n");
+}
+
+static void usage()
+{
+    fprintf(stderr,
+"usage: bench [-l lat,lon]... [-n iterations] [-r repeats] [-s seed] [-f filter] [-o file]\n\
+       bench -c [-s seed]\n\
+  -l lat,lon  reference location (repeatable, default: a set of four)\n\
+  -n N        calls per repeat (default 1000000)\n\
+  -r N        repeats, the best and the median are reported (default 5)\n\
+  -s N        seed for the synthetic inputs (default 1)\n\
+  -f text     only run benchmarks whose name contains this\n\
+  -o file     write the JSON results there (default stdout)\n\
+  -c          instead, check NL at every latitude, and CPR decoding over the globe\n\
+              (and the distance/bearing grid, if built with it)\n");
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    float lats[MAXREFS], lons[MAXREFS];
+    int nrefs = 0;
+    const char *outname = NULL;
+    bool check = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "l:n:r:s:f:o:ch")) != -1) {
+        switch (opt) {
+        case 'l':
+            if (nrefs >= MAXREFS || sscanf(optarg, "%f,%f", &lats[nrefs], &lons[nrefs]) != 2)
+                usage();
+            ++nrefs;
+            break;
+        case 'n':
+            iterations = atoi(optarg);
+            break;
+        case 'r':
+            repeats = atoi(optarg);
+            break;
+        case 's':
+            seed = strtoul(optarg, NULL, 0);
+            break;
+        case 'f':
+            filter = optarg;
+            break;
+        case 'o':
+            outname = optarg;
+            break;
+        case 'c':
+            check = true;
+            break;
+        default:
+            usage();
+        }
+    }
+    if (iterations < 1 || repeats < 1 || seed == 0)
+        usage();
+    if (nrefs == 0) {
+        // mid-latitude, equator, southern hemisphere, high latitude
+        static const float deflats[] = { 42.36, 0.5, -33.95, 64.13 };
+        static const float deflons[] = { -71.0, 10.0, 151.18, -21.94 };
+        for (nrefs=0; nrefs < 4; nrefs++) {
+            lats[nrefs] = deflats[nrefs];
+            lons[nrefs] = deflons[nrefs];
+        }
+    }
+
+    FILE *out = stdout;
+    if (outname) {
+        out = fopen(outname, "w");
+        if (out == NULL) {
+            perror(outname);
+            return 1;
+        }
+    } else {
+        out = fdopen(dup(fileno(stdout)), "w");
+    }
+    // anything the sketch prints (Serial) goes nowhere
+    freopen("/dev/null", "w", stdout);
+
+    EEPROM_setup();
+    settings->dfs = DFSALL;
+    settings->chk_crc = 1;
+    settings->fixbits = 0;
+    settings->parsed = DECODED;
+    settings->alts = ALLALTS;
+    settings->ac_type = 0;
+    settings->follow = 0;
+    settings->debug = 0;
+    settings->minrange = 0;
+    settings->maxrange = BENCH_MAXRANGE;
+    settings->latitude = lats[0];
+    settings->longitude = lons[0];
+    traffic_setup();
+    input_setup();
+    crc_fix_setup(0);
+    CPRRelative_setup();
+
+    if (check) {
+        int bad = cpr_check();
+#if defined(DSTBRG_GRID)
+        bad |= dstbrg_check();
+#endif
+        return bad;
+    }
+
+    rng = seed;
+    for (int i=0; i < NUM_AIRCRAFT; i++)
+        icaos[i] = 0x100000 + (rnd() % 0x6FFFFF);
+
+    rng = seed + 300;
+    run("baseline/empty", b_empty);
+    bench_general();
+    for (int i=0; i < nrefs; i++)
+        bench_location(lats[i], lons[i]);
+
+    json_out(out, nrefs, lats, lons);
+    fclose(out);
+    return 0;
+}
@@ -0,0 +1,388 @@
+/*
+ * hal.cpp - host (Linux) HAL shim and replay driver for dump5892
+ * Copyright (C) 2024 Moshe Braner
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version - see <http://www.gnu.org/licenses/>.
+ */
+
+// Runs the unmodified sketch (setup() and loop()) on a workstation.
+// Serial is the console: output goes to stdout, and console commands given
+// with -c are fed in one at a time.  Serial2 is the GNS5892: a raw capture
+// ("*...;" / "+...;" sentences as sent by the module) is replayed from a
+// file or stdin, either in real time at SERIAL_IN_BR, or at max speed.
+// Serial1 stands in for a GNSS receiver: the lines of an NMEA file given
+// with -g are fed in one per second, as the replay goes on.
+//
+// At max speed the clock is virtual: it advances only with delay() and
+// when loop() finds no input waiting, by the time the next bytes would
+// take to arrive.  So the sketch sees exactly the timing of the capture,
+// but the CPU time it spends is not counted - which is what is wanted when
+// profiling the decoder with perf or cachegrind.  (A THREADED build always
+// replays in real time.)
+
+#include <stdarg.h>
+#include <time.h>
+#include <unistd.h>
+#include <ctype.h>
+#include <atomic>
+
+#include "Arduino.h"
+#include <EEPROM.h>
+#include "dump5892.h"
+
+HardwareSerial Serial(0);
+HardwareSerial Serial1(1);
+HardwareSerial Serial2(2);
+EspClass ESP;
+EEPROMClass EEPROM;
+
+void setup();
+void loop();
+
+#define BYTES_PER_SEC  (SERIAL_IN_BR / 10)    // 8N1 = 10 bits per byte
+#define IDLE_BYTES     32                     // virtual wait when no input
+
+static bool realtime = false;
+static uint64_t start_us;
+static std::atomic<uint64_t> virtual_us(0);    // delay() may be called from two threads
+
+static uint64_t wall_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+}
+
+static uint64_t now_us()
+{
+    if (realtime)
+        return (wall_us() - start_us);
+    return virtual_us;
+}
+
+uint32_t millis() { return (uint32_t) (now_us() / 1000); }
+uint32_t micros() { return (uint32_t) now_us(); }
+
+void delay(uint32_t ms)
+{
+    if (realtime)
+        usleep(ms * 1000);
+    else
+        virtual_us += (uint64_t) ms * 1000;
+}
+
+void yield() {}
+
+char *strupr(char *s)
+{
+    for (char *p = s; *p; p++)
+        *p = toupper(*p);
+    return s;
+}
+
+// the ESP32 CPU cycle counter: the (real, not virtual) time it would be,
+//   in cycles of a 240 MHz clock, so that PRF shows comparable numbers
+uint32_t EspClass::getCycleCount()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t) (((uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec) * 240 / 1000);
+}
+
+void EspClass::restart()
+{
+    fflush(stdout);
+    exit(0);
+}
+
+// --- the replayed GNS5892 input (Serial2) ---
+
+static FILE *replay = NULL;
+static bool replay_eof = false;
+static bool replay_started = false;
+static uint64_t replay_epoch_us;
+static uint64_t arrived = 0;        // bytes that have come over the "wire"
+static uint64_t consumed = 0;       // bytes read by the sketch
+static uint64_t overruns = 0;       // bytes lost to a full RX buffer
+static uint64_t sentences = 0;
+static char *rxbuf = NULL;
+static size_t rxsize = 256;         // default of the ESP32 core
+static size_t rxhead = 0, rxcount = 0;
+
+// move into the RX buffer whatever would have arrived by now
+static void replay_arrive()
+{
+    if (replay == NULL || replay_eof || ! replay_started)
+        return;
+    uint64_t due = ((now_us() - replay_epoch_us) * BYTES_PER_SEC) / 1000000;
+    while (arrived < due) {
+        int c = getc(replay);
+        if (c == EOF) {
+            replay_eof = true;
+            break;
+        }
+        ++arrived;
+        if (c == ';')
+            ++sentences;
+        if (rxcount >= rxsize) {
+            ++overruns;
+            continue;
+        }
+        rxbuf[(rxhead + rxcount) % rxsize] = (char) c;
+        ++rxcount;
+    }
+}
+
+// --- the NMEA feed (Serial1), one line per second of the replay ---
+
+static FILE *gnssfeed = NULL;
+static char gnssline[128];
+static const char *gnssp = NULL;
+static uint64_t gnss_due_us;
+
+static int gnss_available()
+{
+    if (gnssp != NULL && *gnssp != '\0')
+        return strlen(gnssp);
+    if (gnssfeed == NULL || ! replay_started || now_us() < gnss_due_us)
+        return 0;
+    if (fgets(gnssline, sizeof(gnssline), gnssfeed) == NULL) {
+        fclose(gnssfeed);
+        gnssfeed = NULL;
+        return 0;
+    }
+    gnss_due_us += 1000000;
+    gnssp = gnssline;
+    return strlen(gnssp);
+}
+
+// console commands (Serial input), one per loop() iteration
+static char *cmds[64];
+static int ncmds = 0, nextcmd = 0;
+static const char *cmdp = NULL;
+
+void HardwareSerial::begin(unsigned long baud, uint32_t config, int8_t rxPin, int8_t txPin)
+{
+    if (uart_nr == 2 && rxbuf == NULL)
+        rxbuf = (char *) malloc(rxsize);
+}
+
+size_t HardwareSerial::setRxBufferSize(size_t n)
+{
+    if (uart_nr == 2 && rxbuf == NULL)
+        rxsize = n;
+    return n;
+}
+
+int HardwareSerial::available()
+{
+    if (uart_nr == 0)
+        return (cmdp ? strlen(cmdp) : 0);
+    if (uart_nr == 1)
+        return gnss_available();
+    replay_arrive();
+    if (rxcount == 0 && ! realtime && replay_started && ! replay_eof) {
+        // nothing waiting: skip ahead to when more data will have arrived
+        virtual_us += (IDLE_BYTES * 1000000) / BYTES_PER_SEC;
+        replay_arrive();
+    }
+    return (int) rxcount;
+}
+
+int HardwareSerial::read()
+{
+    if (uart_nr == 0) {
+        if (cmdp == NULL || *cmdp == '\0')
+            return -1;
+        return *cmdp++;
+    }
+    if (uart_nr == 1)
+        return (gnss_available() ? *gnssp++ : -1);
+    if (rxcount == 0 && available() == 0)
+        return -1;
+    char c = rxbuf[rxhead];
+    rxhead = (rxhead + 1) % rxsize;
+    --rxcount;
+    ++consumed;
+    return (uint8_t) c;
+}
+
+size_t HardwareSerial::readBytes(char *buffer, size_t length)
+{
+    size_t n = 0;
+    while (n < length) {
+        int c = read();
+        if (c < 0)
+            break;
+        buffer[n++] = (char) c;
+    }
+    return n;
+}
+
+size_t HardwareSerial::write(const char *p, size_t n)
+{
+    if (uart_nr == 0)
+        return fwrite(p, 1, n, stdout);
+    return n;                // commands to the GNS5892 (or GNSS) go nowhere
+}
+
+size_t HardwareSerial::printf(const char *fmt, ...)
+{
+    char buf[1024];
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    if (n < 0)
+        return 0;
+    if (n >= (int) sizeof(buf))
+        n = sizeof(buf) - 1;
+    return write(buf, n);
+}
+
+#if !defined(HAL_NO_MAIN)    // (bench.cpp has a main() of its own)
+
+static void usage()
+{
+    fprintf(stderr,
+"usage: dump5892 [-r] [-q] [-l lat,lon] [-g nmea-file] [-c cmd]... [-s] [capture-file]\n\
+  -r          replay in real time (default: max speed, virtual clock)\n\
+  -q          discard the output stream (only the summary is shown)\n\
+  -l lat,lon  reference location\n\
+  -g file     NMEA sentences (own-ship position) fed in, one line per second\n\
+  -c cmd      console command to run after startup (repeatable), e.g. -c DEC\n\
+  -s          show statistics (STA, and PRF if PROFILING) at the end\n\
+  capture-file  raw GNS5892 output, '-' or none for stdin\n");
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    float lat = 0, lon = 0;
+    bool showstats = false;
+    bool quiet = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "rql:g:c:sh")) != -1) {
+        switch (opt) {
+        case 'r':
+            realtime = true;
+            break;
+        case 'q':
+            quiet = true;
+            break;
+        case 'l':
+            if (sscanf(optarg, "%f,%f", &lat, &lon) != 2)
+                usage();
+            break;
+        case 'g':
+            gnssfeed = fopen(optarg, "r");
+            if (gnssfeed == NULL) {
+                perror(optarg);
+                return 1;
+            }
+            break;
+        case 'c':
+            if (ncmds < 64) {
+                char *c = (char *) malloc(strlen(optarg) + 2);
+                strcpy(c, optarg);
+                strcat(c, "\r");
+                cmds[ncmds++] = c;
+            }
+            break;
+        case 's':
+            showstats = true;
+            break;
+        default:
+            usage();
+        }
+    }
+    if (optind < argc && strcmp(argv[optind], "-") != 0) {
+        replay = fopen(argv[optind], "rb");
+        if (replay == NULL) {
+            perror(argv[optind]);
+            return 1;
+        }
+    } else {
+        replay = stdin;
+    }
+#if defined(THREADED)
+    // two threads cannot share the virtual clock in any meaningful way
+    realtime = true;
+#endif
+    if (quiet)
+        freopen("/dev/null", "w", stdout);
+    static char outbuf[1 << 16];
+    setvbuf(stdout, outbuf, _IOFBF, sizeof(outbuf));
+
+    // pre-load the "EEPROM" with settings that let setup() start Serial2
+    FILE *so = stdout;
+    stdout = fopen("/dev/null", "w");
+    EEPROM_setup();
+    fclose(stdout);
+    stdout = so;
+    settings->rx_pin = 16;
+    settings->tx_pin = 17;
+    settings->latitude = lat;
+    settings->longitude = lon;
+    settings->gnss_pin = (gnssfeed ? 4 : 255);
+    EEPROM_store();
+
+    start_us = wall_us();
+    setup();
+
+    // the commands run before the replay starts, since some of them delay()
+    while (nextcmd < ncmds) {
+        cmdp = cmds[nextcmd++];
+        loop();
+    }
+    cmdp = NULL;
+
+    replay_started = true;
+    replay_epoch_us = now_us();
+    gnss_due_us = replay_epoch_us;
+    uint64_t t0 = wall_us();
+    uint64_t tail_us = 0;
+    for (;;) {
+        loop();
+        if (replay_eof && rxcount == 0) {
+            // let the output formats that run off the clock finish up
+            if (tail_us == 0)
+                tail_us = now_us() + 5000000;
+            if (now_us() >= tail_us)
+                break;
+            if (! realtime)
+                virtual_us += 1000;
+        }
+    }
+    uint64_t t1 = wall_us();
+
+    if (showstats) {
+        char sta[] = "STA";
+        interpret_cmd(sta, 3);
+#if defined(PROFILING)
+        char prf[] = "PRF";
+        interpret_cmd(prf, 3);
+#endif
+    }
+    fflush(stdout);
+
+    uint64_t frames = 0;      // all those that got as far as the DF decoding
+    for (int i=0; i < 23; i++)
+        frames += msg_by_DF[i];
+
+    double secs = (t1 - t0) * 1e-6;
+    fprintf(stderr, "\n%llu bytes, %llu sentences replayed (%.1f s of input)\n",
+        (unsigned long long) arrived, (unsigned long long) sentences,
+        (double) arrived / BYTES_PER_SEC);
+    if (overruns)
+        fprintf(stderr, "%llu bytes lost to RX buffer overrun\n", (unsigned long long) overruns);
+    fprintf(stderr, "%llu frames decoded in %.3f s: %.0f sentences/s, %.0f frames/s\n",
+        (unsigned long long) frames, secs,
+        (secs > 0 ? sentences / secs : 0.0), (secs > 0 ? frames / secs : 0.0));
+    return 0;
+}
+
+#endif  // HAL_NO_MAIN